@@ -10,18 +10,571 @@
 #include <functional> // 解决 greater<T> 未定义
 #include <utility>    // 解决 pair 未定义
 #include <mutex>      // 替代 omp_lock_t
+#include <atomic>
+#include <new>        // align_val_t
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <deque>
+#include <condition_variable>
+#ifdef __linux__
+#include <sched.h>    // sched_setaffinity
+#include <pthread.h>  // pthread_setaffinity_np
+#include <sys/mman.h> // mmap / madvise
+#include <fcntl.h>    // open (O_DIRECT)
+#include <unistd.h>   // pread
+#include <sys/stat.h> // statx / stat (O_DIRECT 对齐)
+#endif
+#ifdef USE_LIBURING
+#include <liburing.h>
+#endif
+#ifdef USE_LIBNUMA
+#include <numa.h>
+#endif
 
 // --- 常量配置 (高召回率优化方案) ---
 static const int M = 36;                  // Keep unchanged
 static const int EF_CONSTRUCTION = 300;   // Increased from 250 (Safe build limit)
 static const int EF_SEARCH = 800;         // Increased from 400 (Aggressive recall boost)
+static const int EF_SEARCH_MAX = 2048;     // W_arr 容量上限
+static const int TOP_K = 10;               // search 返回的结果数
 static const float ML = 1.0f / log(2.0f); // ~1.44
-static const float GAMMA = 1.0f;          // 用于 RobustPrune
+
+// --- NN-Descent 构建模式参数 ---
+static const int NND_K = 64;                         // kNN 图度数 (剪枝前)
+static const int NND_SAMPLE = 24;                    // 每轮每点采样的新/旧邻居数
+static const int NND_MAX_ITERS = 12;                 // 最大迭代轮数
+static const float NND_DELTA = 0.002f;               // 更新数 < delta*N*K 视为收敛
+static const float ML_SPARSE = 1.0f / log((float)M); // 稀疏上层的层级因子 (~0.28)
+
+// --- 波次插入构建模式参数 ---
+static const float HNSW_WAVE_MAX_FRACTION = 0.02f; // 单个波次最多 N 的 2%
+static const int HNSW_WAVE_MIN_CAP = 256;          // 波次上限的下限 (小数据集)
+
+// --- 分治构建模式参数 ---
+static const int PARTITION_MIN_SIZE = 1000;     // 分区容量下限
+static const float PARTITION_FILL = 0.8f;       // 期望分区大小 / 容量 (为不均衡的簇留余量)
+static const int PARTITION_SPARE_CHOICES = 2;   // 近邻分区已满时额外尝试的质心数
+static const int PARTITION_KMEANS_SAMPLE = 256; // k-means 每个质心的采样点数
+static const int PARTITION_KMEANS_ITERS = 10;
+static const unsigned PARTITION_SEED = 8675;
+
+// 入口点表参数
+static const int ENTRY_SAMPLE_PER_CENTROID = 64; // k-means 每个质心的采样点数
+static const int ENTRY_KMEANS_ITERS = 10;        // k-means 迭代轮数
+static const int ENTRY_MAP_EF = 64;              // 质心映射到图节点时的搜索 ef
+static const int ENTRY_SEEDS_MAX = 64;           // 每个查询的种子数上限
+static const unsigned ENTRY_SEED = 12345;        // 采样随机种子 (保证可复现)
+
+// 压缩邻接表: 记录头字节数、数组尾部填充 (解码整字读取)、解码缓冲容量 (count 上限 255，向上取 8 的倍数)
+static const size_t ADJ_PACK_HEADER = 6;
+static const size_t ADJ_PACK_PADDING = 8;
+static const int ADJ_DECODE_CAPACITY = 264;
+
+// 有界距离: 每累加多少维检查一次部分和 (2 的幂，16 的倍数)
+static const int EARLY_ABANDON_CHUNK = 32;
+
+// 降维投影参数
+static const int PROJ_SAMPLE = 10000;   // 协方差采样数
+static const int PROJ_PCA_ITERS = 20;   // 子空间迭代轮数
+static const unsigned PROJ_SEED = 99;
+
+// 二值码参数
+static const unsigned BINARY_ROTATION_SEED = 2024; // 随机旋转种子
+static const int BINARY_SQ8_KEEP_MIN = 100;        // SQ8 重排后保留的最少候选数 (再做 FP32 重排)
+
+// 4-bit fast-scan PQ 参数
+static const int PQ4_KSUB = 16;             // 每段质心数 (4 bit)
+static const int PQ4_BLOCK = 32;            // 每块邻居数 (一次 pshufb 查 32 个)
+static const int PQ4_MAX_SUBSPACES = 128;   // 16 位累加不溢出: 255 * 128 < 32768
+static const int PQ4_TRAIN_SAMPLE = 65536;  // 码本训练采样数
+static const int PQ4_KMEANS_ITERS = 10;
+static const unsigned PQ4_SEED = 777;
+static const float PQ4_SLACK = 1.2f;        // 估计距离 > 最差距离 * SLACK 时跳过精确计算
+
+// 精确 kNN 引擎参数
+static const int EXACT_QUERY_TILE = 8;      // 每组查询数 (8 个累加器 + 1 个基向量寄存器)
+static const int EXACT_BASE_TILE = 512;     // 基向量块 (块内向量常驻 L2)
+static const int EXACT_FALLBACK_MAX = 4096; // 不超过该规模的索引直接精确搜索
+
+// --- 大页内存分配 ---
+// 大块 (>= HUGE_PAGE_THRESHOLD) 在头部记录 {base, len, kind}，释放时据此 munmap / delete；
+// 小块直接走 operator new。三种模式:
+//   HUGEPAGE_OFF     普通 operator new (不做 2 MiB 补齐与对齐)
+//   HUGEPAGE_THP     2 MiB 对齐 + madvise(MADV_HUGEPAGE)，由内核透明大页兜底
+//   HUGEPAGE_HUGETLB 显式 MAP_HUGETLB (>= 1 GiB 时先试 1 GiB 页)，失败回退 THP
+static const size_t HUGE_PAGE_SIZE = 2u << 20;
+static const size_t HUGE_PAGE_SIZE_1G = 1u << 30;
+static const size_t HUGE_PAGE_THRESHOLD = HUGE_PAGE_SIZE;
+static const size_t HUGE_PAGE_HEADER = 64; // 保持数据 64B 对齐
+
+static std::atomic<int> g_huge_page_mode(Solution::HUGEPAGE_THP);
+
+struct HugeMappingHeader
+{
+    void *base;
+    size_t len;
+    int kind; // 0: operator new, 1: mmap
+};
+
+static size_t round_up(size_t v, size_t align)
+{
+    return (v + align - 1) / align * align;
+}
+
+void Solution::set_huge_page_mode(HugePageMode mode)
+{
+    g_huge_page_mode.store(mode);
+}
+
+void *huge_page_alloc(size_t bytes)
+{
+    if (bytes < HUGE_PAGE_THRESHOLD)
+        return ::operator new(bytes);
+
+    const size_t need = bytes + HUGE_PAGE_HEADER;
+    void *base = nullptr;
+    size_t len = 0;
+    char *start = nullptr;
+    int kind = 1;
+
+#if defined(__linux__)
+    const int mode = g_huge_page_mode.load();
+    if (mode == Solution::HUGEPAGE_HUGETLB)
+    {
+#if defined(MAP_HUGETLB)
+        // 1 GiB 页只在浪费不超过一半时尝试
+        if (need >= HUGE_PAGE_SIZE_1G)
+        {
+#if defined(MAP_HUGE_1GB)
+            len = round_up(need, HUGE_PAGE_SIZE_1G);
+            if (len - need < len / 2)
+            {
+                base = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_1GB, -1, 0);
+                if (base == MAP_FAILED)
+                    base = nullptr;
+            }
+#endif
+        }
+        if (!base)
+        {
+            len = round_up(need, HUGE_PAGE_SIZE);
+            base = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (base == MAP_FAILED)
+                base = nullptr;
+        }
+        if (base)
+            start = (char *)base;
+#endif
+    }
+    if (!base && mode != Solution::HUGEPAGE_OFF)
+    {
+        // THP: 多映射 2 MiB 以便对齐到大页边界
+        len = round_up(need, HUGE_PAGE_SIZE) + HUGE_PAGE_SIZE;
+        base = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED)
+        {
+            base = nullptr;
+        }
+        else
+        {
+            start = (char *)round_up((size_t)base, HUGE_PAGE_SIZE);
+#if defined(MADV_HUGEPAGE)
+            madvise(start, round_up(need, HUGE_PAGE_SIZE), MADV_HUGEPAGE);
+#endif
+        }
+    }
+#endif
+    if (!base)
+    {
+        // OFF、非 Linux 或 mmap 失败: 普通分配 (只多出头部)
+        kind = 0;
+        base = ::operator new(need, std::align_val_t(HUGE_PAGE_HEADER));
+        len = need;
+        start = (char *)base;
+    }
+
+    HugeMappingHeader *header = (HugeMappingHeader *)start;
+    header->base = base;
+    header->len = len;
+    header->kind = kind;
+    return start + HUGE_PAGE_HEADER;
+}
+
+void huge_page_free(void *p, size_t bytes)
+{
+    if (!p)
+        return;
+    if (bytes < HUGE_PAGE_THRESHOLD)
+    {
+        ::operator delete(p);
+        return;
+    }
+    HugeMappingHeader *header = (HugeMappingHeader *)((char *)p - HUGE_PAGE_HEADER);
+#if defined(__linux__)
+    if (header->kind == 1)
+    {
+        munmap(header->base, header->len);
+        return;
+    }
+#endif
+    ::operator delete(header->base, std::align_val_t(HUGE_PAGE_HEADER));
+}
+
+// 大页覆盖率: 统计 /proc/self/smaps 中与索引数组重叠的映射里的 AnonHugePages / Hugetlb
+Solution::HugePageStats Solution::huge_page_stats() const
+{
+    HugePageStats stats = {0, 0};
+    vector<pair<size_t, size_t>> ranges; // [begin, end)
+    auto track = [&](const void *p, size_t bytes)
+    {
+        if (p && bytes > 0)
+        {
+            ranges.push_back({(size_t)p, (size_t)p + bytes});
+            stats.total_bytes += bytes;
+        }
+    };
+    track(data_flat.data(), data_flat.size() * sizeof(float));
+    track(data_full.data(), data_full.size() * sizeof(float));
+    track(data_half.data(), data_half.size() * sizeof(uint16_t));
+    track(data_quant.data(), data_quant.size());
+    track(final_graph_flat.data(), final_graph_flat.size() * sizeof(int));
+    track(graph_packed.data(), graph_packed.size());
+    track(final_graph_offsets.data(), final_graph_offsets.size() * sizeof(size_t));
+
+#if defined(__linux__)
+    ifstream smaps("/proc/self/smaps");
+    string line;
+    size_t vma_begin = 0, vma_end = 0, overlap = 0;
+    while (getline(smaps, line))
+    {
+        if (line.empty())
+            continue;
+        if (isxdigit((unsigned char)line[0]) && line.find('-') != string::npos && line.find(':') > line.find(' '))
+        {
+            // 新 VMA: "begin-end perms ..."
+            vma_begin = strtoull(line.c_str(), nullptr, 16);
+            vma_end = strtoull(line.c_str() + line.find('-') + 1, nullptr, 16);
+            overlap = 0;
+            for (const auto &r : ranges)
+            {
+                size_t lo = max(r.first, vma_begin);
+                size_t hi = min(r.second, vma_end);
+                if (lo < hi)
+                    overlap += hi - lo;
+            }
+            continue;
+        }
+        if (overlap == 0)
+            continue;
+        if (line.rfind("AnonHugePages:", 0) == 0 ||
+            line.rfind("Private_Hugetlb:", 0) == 0 ||
+            line.rfind("Shared_Hugetlb:", 0) == 0)
+        {
+            size_t kb = strtoull(line.c_str() + line.find(':') + 1, nullptr, 10);
+            stats.huge_bytes += min(kb * 1024, overlap);
+        }
+    }
+#endif
+    stats.huge_bytes = min(stats.huge_bytes, stats.total_bytes);
+    return stats;
+}
+
+// --- 并行执行器 ---
+
+int OpenMPExecutor::concurrency() const
+{
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+void OpenMPExecutor::parallel_for(int begin, int end, int grain, const function<void(int, int)> &body)
+{
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, grain)
+    for (int i = begin; i < end; ++i)
+        body(i, omp_get_thread_num());
+#else
+    (void)grain;
+    for (int i = begin; i < end; ++i)
+        body(i, 0);
+#endif
+}
+
+struct WorkStealingPool::Impl
+{
+    // 每个线程的块下标区间 [lo, hi)：本线程从 lo 取，窃取者从 hi 取
+    struct Range
+    {
+        std::mutex lock;
+        int lo = 0;
+        int hi = 0;
+    };
+
+    int num_threads = 1;
+    int caller_cpu = -1; // >= 0: parallel_for 期间调用线程绑定的 CPU
+    vector<std::thread> workers;
+    vector<unique_ptr<Range>> ranges;
+
+    std::mutex call_mutex; // 串行化外部调用
+    std::mutex state_mutex;
+    std::condition_variable job_cv, done_cv;
+    uint64_t generation = 0;
+    int running = 0;
+    bool stop = false;
+
+    // 当前任务
+    const function<void(int, int)> *body = nullptr;
+    int begin = 0, end = 0, grain = 1;
+
+    bool take(int worker, int &chunk)
+    {
+        Range &r = *ranges[worker];
+        std::lock_guard<std::mutex> lock(r.lock);
+        if (r.lo >= r.hi)
+            return false;
+        chunk = r.lo++;
+        return true;
+    }
+
+    bool steal(int worker, int &chunk)
+    {
+        for (int k = 1; k < num_threads; ++k)
+        {
+            Range &r = *ranges[(worker + k) % num_threads];
+            std::lock_guard<std::mutex> lock(r.lock);
+            if (r.lo < r.hi)
+            {
+                chunk = --r.hi;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(int worker)
+    {
+        int chunk;
+        while (take(worker, chunk) || steal(worker, chunk))
+        {
+            int lo = begin + chunk * grain;
+            int hi = min(end, lo + grain);
+            for (int i = lo; i < hi; ++i)
+                (*body)(i, worker);
+        }
+    }
+
+    void start(int threads, const vector<int> &cpus);
+    void worker_loop(int worker);
+};
+
+// 当前线程所属的池与线程编号 (嵌套调用检测)
+static thread_local const void *tls_pool_owner = nullptr;
+static thread_local int tls_pool_worker = 0;
+
+#ifdef __linux__
+static vector<int> allowed_cpus()
+{
+    vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+    {
+        for (int c = 0; c < CPU_SETSIZE; ++c)
+        {
+            if (CPU_ISSET(c, &set))
+                cpus.push_back(c);
+        }
+    }
+    return cpus;
+}
+#endif
+
+void WorkStealingPool::Impl::worker_loop(int worker)
+{
+    tls_pool_owner = this;
+    tls_pool_worker = worker;
+    uint64_t seen = 0;
+    while (true)
+    {
+        std::unique_lock<std::mutex> lock(state_mutex);
+        job_cv.wait(lock, [&] { return stop || generation != seen; });
+        if (stop)
+            return;
+        seen = generation;
+        lock.unlock();
+
+        run(worker);
+
+        lock.lock();
+        if (--running == 0)
+            done_cv.notify_all();
+    }
+}
+
+void WorkStealingPool::Impl::start(int threads, const vector<int> &cpus)
+{
+    num_threads = threads;
+    for (int t = 0; t < num_threads; ++t)
+        ranges.emplace_back(new Range());
+    // 0 号线程为调用线程，只在 pin_caller 时于调用期间绑核
+    for (int t = 1; t < num_threads; ++t)
+    {
+        workers.emplace_back([this, t]() { worker_loop(t); });
+#ifdef __linux__
+        if (!cpus.empty())
+        {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpus[t % cpus.size()], &set);
+            pthread_setaffinity_np(workers.back().native_handle(), sizeof(set), &set);
+        }
+#endif
+    }
+}
+
+WorkStealingPool::WorkStealingPool(int num_threads, bool pin_threads) : impl(new Impl())
+{
+    if (num_threads <= 0)
+        num_threads = max(1, (int)std::thread::hardware_concurrency());
+#ifdef __linux__
+    vector<int> cpus = pin_threads ? allowed_cpus() : vector<int>();
+#else
+    (void)pin_threads;
+    vector<int> cpus;
+#endif
+    impl->start(num_threads, cpus);
+}
+
+WorkStealingPool::WorkStealingPool(const vector<int> &cpus) : impl(new Impl())
+{
+    impl->caller_cpu = cpus.empty() ? -1 : cpus[0];
+    impl->start(max(1, (int)cpus.size()), cpus);
+}
+
+// 调用期间把调用线程 (0 号线程) 绑到 caller_cpu，结束后恢复原亲和性
+struct CallerPin
+{
+#ifdef __linux__
+    cpu_set_t saved;
+    bool active = false;
+    explicit CallerPin(int cpu)
+    {
+        if (cpu < 0 || sched_getaffinity(0, sizeof(saved), &saved) != 0)
+            return;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        active = sched_setaffinity(0, sizeof(set), &set) == 0;
+    }
+    ~CallerPin()
+    {
+        if (active)
+            sched_setaffinity(0, sizeof(saved), &saved);
+    }
+#else
+    explicit CallerPin(int) {}
+#endif
+};
+
+WorkStealingPool::~WorkStealingPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(impl->state_mutex);
+        impl->stop = true;
+    }
+    impl->job_cv.notify_all();
+    for (auto &w : impl->workers)
+        w.join();
+}
+
+int WorkStealingPool::concurrency() const
+{
+    return impl->num_threads;
+}
+
+void WorkStealingPool::parallel_for(int begin, int end, int grain, const function<void(int, int)> &body)
+{
+    if (begin >= end)
+        return;
+    // 池内嵌套调用: 串行执行
+    if (tls_pool_owner == impl.get())
+    {
+        for (int i = begin; i < end; ++i)
+            body(i, tls_pool_worker);
+        return;
+    }
+
+    std::lock_guard<std::mutex> call(impl->call_mutex);
+    CallerPin pin(impl->caller_cpu);
+    const int T = impl->num_threads;
+    grain = max(1, grain);
+    const int num_chunks = (int)(((long long)end - begin + grain - 1) / grain);
+    if (T > 1)
+    {
+        impl->body = &body;
+        impl->begin = begin;
+        impl->end = end;
+        impl->grain = grain;
+        for (int t = 0; t < T; ++t)
+        {
+            Impl::Range &r = *impl->ranges[t];
+            std::lock_guard<std::mutex> lock(r.lock);
+            r.lo = (int)((long long)num_chunks * t / T);
+            r.hi = (int)((long long)num_chunks * (t + 1) / T);
+        }
+        {
+            std::lock_guard<std::mutex> lock(impl->state_mutex);
+            impl->generation++;
+            impl->running = T - 1;
+        }
+        impl->job_cv.notify_all();
+    }
+
+    // 调用线程作为 0 号线程参与 (单线程池时独自完成)
+    const void *prev_owner = tls_pool_owner;
+    int prev_worker = tls_pool_worker;
+    tls_pool_owner = impl.get();
+    tls_pool_worker = 0;
+    if (T > 1)
+    {
+        impl->run(0);
+    }
+    else
+    {
+        for (int i = begin; i < end; ++i)
+            body(i, 0);
+    }
+    tls_pool_owner = prev_owner;
+    tls_pool_worker = prev_worker;
+
+    if (T > 1)
+    {
+        std::unique_lock<std::mutex> lock(impl->state_mutex);
+        impl->done_cv.wait(lock, [&] { return impl->running == 0; });
+    }
+}
+
+// 默认执行器 (静态函数如 train_kmeans / exact_knn 未指定执行器时也使用它)
+static Executor &default_executor()
+{
+    static OpenMPExecutor executor;
+    return executor;
+}
+
+Executor &Solution::executor() const
+{
+    return custom_executor ? *custom_executor : default_executor();
+}
 
 // --- 线程局部存储优化 (Optimization 2) ---
 struct VisitedBuffer
 {
-    vector<int> visited_tags;
+    huge_vector<int> visited_tags;
     int current_tag;
 
     VisitedBuffer() : current_tag(0) {}
@@ -54,6 +607,15 @@ struct VisitedBuffer
 
 static thread_local VisitedBuffer tls_visited;
 static thread_local vector<unsigned char> tls_quant_query_buf;    // 避免频繁申请内存
+static thread_local vector<unsigned char> tls_upper_query_quant;  // 紧凑高层 SQ8 下降用的查询编码
+static thread_local vector<unsigned char> tls_cache_code;         // 结果缓存的键
+static thread_local vector<float> tls_binary_rotated;             // 二值编码时的旋转结果
+static thread_local vector<uint64_t> tls_query_bits;              // 查询的二值码
+static thread_local vector<pair<float, int>> tls_sq8_rerank;      // 二值遍历后的 SQ8 重排
+static thread_local vector<float> tls_projected_query;            // 投影后的查询
+static thread_local vector<float> tls_pq4_lut_float;              // fast-scan 距离表 (量化前)
+static thread_local vector<uint8_t> tls_pq4_lut;                  // fast-scan 距离表 (uint8)
+static thread_local vector<uint16_t> tls_pq4_scores;              // 一个邻居表的估计距离
 static thread_local vector<pair<float, int>> tls_candidate_queue; // [性能优化] 复用候选队列内存
 
 // --- 辅助结构：固定大小的候选集 (Optimization 5) ---
@@ -76,7 +638,7 @@ struct Candidate
 // --- 距离计算实现 ---
 
 // 优化1: AVX2 SIMD 浮点距离
-inline float Solution::dist_l2_float_avx(const float *a, const float *b, int d) const
+inline float Solution::dist_l2_float_avx(const float *a, const float *b, int d)
 {
 #if defined(__AVX2__)
     __m256 sum = _mm256_setzero_ps();
@@ -110,10 +672,19 @@ inline float Solution::dist_l2_float_avx(const float *a, const float *b, int d)
 #endif
 }
 
-// 方案A: 量化距离计算 (Layer 0 专用)
-inline float Solution::dist_l2_quant(int id_a, const unsigned char *b_quant, int d) const
+// ||v||² (精确 kNN 引擎)
+static inline float squared_norm(const float *v, int d)
+{
+    float s = 0.0f;
+#pragma omp simd reduction(+ : s)
+    for (int j = 0; j < d; ++j)
+        s += v[j] * v[j];
+    return s;
+}
+
+// SQ8 码之间的距离 (Layer 0 量化距离与紧凑高层共用)
+static inline float dist_l2_u8(const unsigned char *p_quant, const unsigned char *b_quant, int d)
 {
-    const unsigned char *p_quant = &data_quant[(long long)id_a * d];
     long long raw_dist_sq = 0;
 
 // 指南要求的实现方式，利用Simd Reduction
@@ -127,728 +698,5174 @@ inline float Solution::dist_l2_quant(int id_a, const unsigned char *b_quant, int
     return (float)raw_dist_sq;
 }
 
-// --- 量化逻辑 ---
-
-void Solution::init_quantization()
+// 方案A: 量化距离计算 (Layer 0 专用)
+inline float Solution::dist_l2_quant(int id_a, const unsigned char *b_quant, int d) const
 {
-    if (num_vectors == 0)
-        return;
+    return dist_l2_u8(&data_quant[(long long)id_a * d], b_quant, d);
+}
 
-    // 1. 计算全局范围
-    float min_val = std::numeric_limits<float>::max();
-    float max_val = std::numeric_limits<float>::lowest();
+// --- 半精度存储 (FP16 / BF16) ---
 
-    // 采样部分向量以加速范围计算 (全部遍历也很快，这里为稳妥全遍历)
-    for (const auto &v : data_flat)
+// 标量转换 (round-to-nearest-even)，作为 SIMD 路径的尾部处理和回退
+static inline uint16_t fp32_to_fp16(float f)
+{
+#if defined(__F16C__)
+    return _cvtss_sh(f, _MM_FROUND_TO_NEAREST_INT);
+#else
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t raw_exp = (x >> 23) & 0xff;
+    uint32_t mant = x & 0x7fffff;
+    if (raw_exp == 0xff)
+        return (uint16_t)(sign | 0x7c00 | (mant ? 0x200 : 0)); // Inf / NaN
+    int exp = (int)raw_exp - 127 + 15;
+    if (exp >= 31)
+        return (uint16_t)(sign | 0x7c00); // 上溢为 Inf
+    if (exp <= 0)
     {
-        if (v < min_val)
-            min_val = v;
-        if (v > max_val)
-            max_val = v;
+        // 次正规数
+        if (exp < -10)
+            return (uint16_t)sign;
+        mant |= 0x800000;
+        int shift = 14 - exp;
+        uint32_t h = mant >> shift;
+        uint32_t rem = mant & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rem > halfway || (rem == halfway && (h & 1)))
+            h++;
+        return (uint16_t)(sign | h);
     }
+    uint32_t h = ((uint32_t)exp << 10) | (mant >> 13);
+    uint32_t rem = mant & 0x1fff;
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1)))
+        h++; // 进位可自然溢出到指数位
+    return (uint16_t)(sign | h);
+#endif
+}
 
-    global_min = min_val;
-    if (max_val - min_val < 1e-6f)
+static inline float fp16_to_fp32(uint16_t h)
+{
+#if defined(__F16C__)
+    return _cvtsh_ss(h);
+#else
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    uint32_t bits;
+    if (exp == 0)
     {
-        global_scale_inv = 0;
-        use_quantization = false;
+        if (mant == 0)
+        {
+            bits = sign;
+        }
+        else
+        {
+            // 次正规数规格化
+            exp = 127 - 15 + 1;
+            while (!(mant & 0x400))
+            {
+                mant <<= 1;
+                exp--;
+            }
+            bits = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+        }
     }
-    else
+    else if (exp == 31)
     {
-        global_scale_inv = 255.0f / (max_val - min_val);
-        use_quantization = true;
+        bits = sign | 0x7f800000 | (mant << 13);
     }
-
-    // 2. 量化所有基库向量
-    long long total_elements = (long long)num_vectors * dimension;
-    data_quant.resize(total_elements);
-
-#pragma omp parallel for
-    for (int i = 0; i < num_vectors; ++i)
+    else
     {
-        quantize_vec(&data_flat[i * dimension], &data_quant[(long long)i * dimension]);
+        bits = sign | ((exp + 112) << 23) | (mant << 13);
     }
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+#endif
 }
 
-inline void Solution::quantize_vec(const float *src, unsigned char *dst) const
+static inline uint16_t fp32_to_bf16(float f)
 {
-    if (!use_quantization)
-        return;
-    for (int i = 0; i < dimension; ++i)
-    {
-        int q = static_cast<int>((src[i] - global_min) * global_scale_inv + 0.5f);
-        if (q < 0)
-            q = 0;
-        if (q > 255)
-            q = 255;
-        dst[i] = (unsigned char)q;
-    }
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    if ((x & 0x7fffffff) > 0x7f800000)
+        return (uint16_t)((x >> 16) | 0x40); // 保持 NaN
+    x += 0x7fff + ((x >> 16) & 1);
+    return (uint16_t)(x >> 16);
 }
 
-// --- 搜索层逻辑 ---
-
-// 构建阶段使用的搜索 (精确距离，操作动态图)
-void Solution::search_layer_build(const float *query, vector<int> &candidates,
-                                  const vector<int> &ep, int ef, int lc) const
+static inline float bf16_to_fp32(uint16_t h)
 {
+    uint32_t bits = (uint32_t)h << 16;
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
 
-    Candidate top_candidates[512]; // Fixed size buffer
-    int sz = 0;
-
-    tls_visited.prepare(num_vectors);
-
-    // 优先队列逻辑 (使用std::priority_queue会慢，这里用简单的排序数组或堆)
-    // 为保持代码简洁且遵循指南，使用标准的最小/最大堆逻辑
+// 编码: FP16 走 F16C (vcvtps2ph)，BF16 走 AVX512_BF16 (vcvtneps2bf16)
+void Solution::encode_half(const float *src, uint16_t *dst) const
+{
+    int i = 0;
+    if (vector_storage == STORAGE_FP16)
+    {
+#if defined(__F16C__) && defined(__AVX__)
+        for (; i + 8 <= dimension; i += 8)
+        {
+            __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+            _mm_storeu_si128((__m128i *)(dst + i), h);
+        }
+#endif
+        for (; i < dimension; ++i)
+            dst[i] = fp32_to_fp16(src[i]);
+    }
+    else
+    {
+#if defined(__AVX512BF16__) && defined(__AVX512F__)
+        for (; i + 16 <= dimension; i += 16)
+        {
+            __m256bh h = _mm512_cvtneps_pbh(_mm512_loadu_ps(src + i));
+            memcpy(dst + i, &h, sizeof(h));
+        }
+#endif
+        for (; i < dimension; ++i)
+            dst[i] = fp32_to_bf16(src[i]);
+    }
+}
+
+void Solution::decode_half(const uint16_t *src, float *dst) const
+{
+    int i = 0;
+    if (vector_storage == STORAGE_FP16)
+    {
+#if defined(__F16C__) && defined(__AVX__)
+        for (; i + 8 <= dimension; i += 8)
+        {
+            _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(src + i))));
+        }
+#endif
+        for (; i < dimension; ++i)
+            dst[i] = fp16_to_fp32(src[i]);
+    }
+    else
+    {
+#if defined(__AVX2__)
+        for (; i + 8 <= dimension; i += 8)
+        {
+            __m256i w = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(src + i)));
+            _mm256_storeu_ps(dst + i, _mm256_castsi256_ps(_mm256_slli_epi32(w, 16)));
+        }
+#endif
+        for (; i < dimension; ++i)
+            dst[i] = bf16_to_fp32(src[i]);
+    }
+}
+
+// FP32 query 与 FP16 基向量的 L2 距离 (加载时转换，带宽减半)
+inline float Solution::dist_l2_fp16(const float *a, const uint16_t *b, int d) const
+{
+    int i = 0;
+    float total = 0;
+#if defined(__F16C__) && defined(__AVX2__)
+    __m256 sum = _mm256_setzero_ps();
+    for (; i + 8 <= d; i += 8)
+    {
+        __m256 vb = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(b + i)));
+        __m256 diff = _mm256_sub_ps(_mm256_loadu_ps(a + i), vb);
+        sum = _mm256_fmadd_ps(diff, diff, sum);
+    }
+    float res[8];
+    _mm256_storeu_ps(res, sum);
+    total = res[0] + res[1] + res[2] + res[3] + res[4] + res[5] + res[6] + res[7];
+#endif
+    for (; i < d; ++i)
+    {
+        float diff = a[i] - fp16_to_fp32(b[i]);
+        total += diff * diff;
+    }
+    return total;
+}
+
+// FP32 query 与 BF16 基向量的 L2 距离 (bf16 -> fp32 即左移 16 位)
+inline float Solution::dist_l2_bf16(const float *a, const uint16_t *b, int d) const
+{
+    int i = 0;
+    float total = 0;
+#if defined(__AVX2__)
+    __m256 sum = _mm256_setzero_ps();
+    for (; i + 8 <= d; i += 8)
+    {
+        __m256i w = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(b + i)));
+        __m256 vb = _mm256_castsi256_ps(_mm256_slli_epi32(w, 16));
+        __m256 diff = _mm256_sub_ps(_mm256_loadu_ps(a + i), vb);
+        sum = _mm256_fmadd_ps(diff, diff, sum);
+    }
+    float res[8];
+    _mm256_storeu_ps(res, sum);
+    total = res[0] + res[1] + res[2] + res[3] + res[4] + res[5] + res[6] + res[7];
+#endif
+    for (; i < d; ++i)
+    {
+        float diff = a[i] - bf16_to_fp32(b[i]);
+        total += diff * diff;
+    }
+    return total;
+}
+
+// --- 存储无关的距离接口 ---
+
+// FP32 向量指针: FP32 存储直接返回，半精度存储解码到 buf
+inline const float *Solution::get_vector(int id, float *buf) const
+{
+    if (vector_storage == STORAGE_FP32)
+        return &data_flat[(size_t)id * dimension];
+    decode_half(&data_half[(size_t)id * dimension], buf);
+    return buf;
+}
+
+// 存储中向量的起始地址 (预取用)
+inline const char *Solution::vector_addr(int id) const
+{
+    if (vector_storage == STORAGE_FP32)
+        return (const char *)&data_flat[(size_t)id * dimension];
+    return (const char *)&data_half[(size_t)id * dimension];
+}
+
+// FP32 query 到基向量 id
+inline float Solution::dist_query(const float *query, int id) const
+{
+    switch (vector_storage)
+    {
+    case STORAGE_FP16:
+        return dist_l2_fp16(query, &data_half[(size_t)id * dimension], dimension);
+    case STORAGE_BF16:
+        return dist_l2_bf16(query, &data_half[(size_t)id * dimension], dimension);
+    default:
+        return dist_l2_float_avx(query, &data_flat[(size_t)id * dimension], dimension);
+    }
+}
+
+// --- 提前终止的有界距离 (Layer 0 遍历) ---
+// 按 EARLY_ABANDON_CHUNK 维分块累加，部分和已 >= bound 时直接返回 (该邻居必然被拒绝)；
+// 返回值 < bound 时等于完整距离。load8 / load1 负责把基向量的 8 个 / 1 个分量转为 FP32。
+template <typename Load8, typename Load1>
+static inline float dist_l2_bounded(const float *a, int d, float bound, Load8 load8, Load1 load1)
+{
+    int i = 0;
+    float total = 0.0f;
+#if defined(__AVX2__)
+    for (; i + EARLY_ABANDON_CHUNK <= d; i += EARLY_ABANDON_CHUNK)
+    {
+        __m256 s0 = _mm256_setzero_ps();
+        __m256 s1 = _mm256_setzero_ps();
+        for (int j = i; j < i + EARLY_ABANDON_CHUNK; j += 16)
+        {
+            __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + j), load8(j));
+            __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + j + 8), load8(j + 8));
+            s0 = _mm256_fmadd_ps(d0, d0, s0);
+            s1 = _mm256_fmadd_ps(d1, d1, s1);
+        }
+        float res[8];
+        _mm256_storeu_ps(res, _mm256_add_ps(s0, s1));
+        total += res[0] + res[1] + res[2] + res[3] + res[4] + res[5] + res[6] + res[7];
+        if (total >= bound)
+            return total;
+    }
+    if (i + 8 <= d)
+    {
+        __m256 sum = _mm256_setzero_ps();
+        for (; i + 8 <= d; i += 8)
+        {
+            __m256 diff = _mm256_sub_ps(_mm256_loadu_ps(a + i), load8(i));
+            sum = _mm256_fmadd_ps(diff, diff, sum);
+        }
+        float res[8];
+        _mm256_storeu_ps(res, sum);
+        total += res[0] + res[1] + res[2] + res[3] + res[4] + res[5] + res[6] + res[7];
+    }
+#endif
+    for (; i < d; ++i)
+    {
+        float diff = a[i] - load1(i);
+        total += diff * diff;
+        if ((i & (EARLY_ABANDON_CHUNK - 1)) == EARLY_ABANDON_CHUNK - 1 && total >= bound)
+            return total;
+    }
+    return total;
+}
+
+// FP32 query 到基向量 id 的有界距离 (按存储格式分派；未开启时退化为 dist_query)
+inline float Solution::dist_query_bounded(const float *query, int id, float bound) const
+{
+    if (!early_abandon || bound == std::numeric_limits<float>::max())
+        return dist_query(query, id);
+    switch (vector_storage)
+    {
+    case STORAGE_FP16:
+    {
+        const uint16_t *b = &data_half[(size_t)id * dimension];
+        return dist_l2_bounded(
+            query, dimension, bound,
+            [b](int j)
+            {
+#if defined(__F16C__) && defined(__AVX2__)
+                return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(b + j)));
+#else
+                return 0;
+#endif
+            },
+            [b](int j) { return fp16_to_fp32(b[j]); });
+    }
+    case STORAGE_BF16:
+    {
+        const uint16_t *b = &data_half[(size_t)id * dimension];
+        return dist_l2_bounded(
+            query, dimension, bound,
+            [b](int j)
+            {
+#if defined(__AVX2__)
+                __m256i w = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(b + j)));
+                return _mm256_castsi256_ps(_mm256_slli_epi32(w, 16));
+#else
+                return 0;
+#endif
+            },
+            [b](int j) { return bf16_to_fp32(b[j]); });
+    }
+    default:
+    {
+        const float *b = &data_flat[(size_t)id * dimension];
+        return dist_l2_bounded(
+            query, dimension, bound,
+            [b](int j)
+            {
+#if defined(__AVX2__)
+                return _mm256_loadu_ps(b + j);
+#else
+                return 0;
+#endif
+            },
+            [b](int j) { return b[j]; });
+    }
+    }
+}
+
+// 基向量之间 (构建期剪枝)
+static thread_local vector<float> tls_decode_buf;
+
+inline float Solution::dist_nodes(int a, int b) const
+{
+    if (vector_storage == STORAGE_FP32)
+        return dist_l2_float_avx(&data_flat[(size_t)a * dimension], &data_flat[(size_t)b * dimension], dimension);
+    tls_decode_buf.resize(dimension);
+    return dist_query(get_vector(a, tls_decode_buf.data()), b);
+}
+
+// --- 软件预取 ---
+
+// 按维度选择预取参数: 行数覆盖整条向量，向量越短预取得越远
+void Solution::configure_prefetch()
+{
+    size_t elem_bytes = (vector_storage == STORAGE_FP32) ? sizeof(float) : sizeof(uint16_t);
+    int vec_lines = (int)((dimension * elem_bytes + 63) / 64);
+    if (vec_lines < 1)
+        vec_lines = 1;
+
+    pf_lines = (prefetch_lines_cfg >= 0) ? min(prefetch_lines_cfg, vec_lines) : vec_lines;
+    pf_distance = (prefetch_distance_cfg >= 0) ? prefetch_distance_cfg : max(1, min(4, 16 / vec_lines));
+    adj_lines = (int)(((M_max0 + 1) * sizeof(int) + 63) / 64);
+}
+
+void Solution::set_prefetch(int distance, int lines)
+{
+    prefetch_distance_cfg = distance;
+    prefetch_lines_cfg = lines;
+    if (num_vectors > 0)
+        configure_prefetch();
+}
+
+inline void Solution::prefetch_vector(int id) const
+{
+    const char *p = vector_addr(id);
+    for (int l = 0; l < pf_lines; ++l)
+        _mm_prefetch(p + 64 * l, _MM_HINT_T0);
+}
+
+inline void Solution::prefetch_adjacency(int id) const
+{
+    const char *p = graph_packed.empty() ? (const char *)&final_graph_flat[final_graph_offsets[id]]
+                                         : (const char *)&graph_packed[final_graph_offsets[id]];
+    for (int l = 0; l < adj_lines; ++l)
+        _mm_prefetch(p + 64 * l, _MM_HINT_T0);
+}
+
+// --- 量化逻辑 ---
+
+void Solution::init_quantization()
+{
+    if (num_vectors == 0)
+        return;
+
+    // 1. 计算全局范围 (全遍历，各执行线程先求局部极值再合并)
+    Executor &exec = executor();
+    const int workers = max(1, exec.concurrency());
+    vector<float> local_min(workers, std::numeric_limits<float>::max());
+    vector<float> local_max(workers, std::numeric_limits<float>::lowest());
+    exec.parallel_for(0, num_vectors, 1024, [&](int i, int w)
+    {
+        tls_decode_buf.resize(dimension);
+        const float *vec = get_vector(i, tls_decode_buf.data());
+        float lo = local_min[w], hi = local_max[w];
+        for (int j = 0; j < dimension; ++j)
+        {
+            lo = min(lo, vec[j]);
+            hi = max(hi, vec[j]);
+        }
+        local_min[w] = lo;
+        local_max[w] = hi;
+    });
+    float min_val = *min_element(local_min.begin(), local_min.end());
+    float max_val = *max_element(local_max.begin(), local_max.end());
+
+    global_min = min_val;
+    if (max_val - min_val < 1e-6f)
+    {
+        global_scale_inv = 0;
+        use_quantization = false;
+    }
+    else
+    {
+        global_scale_inv = 255.0f / (max_val - min_val);
+        use_quantization = true;
+    }
+
+    // 2. 量化所有基库向量
+    long long total_elements = (long long)num_vectors * dimension;
+    data_quant.resize(total_elements);
+
+    exec.parallel_for(0, num_vectors, 1024, [&](int i, int)
+    {
+        tls_decode_buf.resize(dimension);
+        quantize_vec(get_vector(i, tls_decode_buf.data()), &data_quant[(long long)i * dimension]);
+    });
+}
+
+inline void Solution::quantize_vec(const float *src, unsigned char *dst) const
+{
+    if (!use_quantization)
+        return;
+    for (int i = 0; i < dimension; ++i)
+    {
+        int q = static_cast<int>((src[i] - global_min) * global_scale_inv + 0.5f);
+        if (q < 0)
+            q = 0;
+        if (q > 255)
+            q = 255;
+        dst[i] = (unsigned char)q;
+    }
+}
+
+// --- 降维投影 (PCA / 随机投影) ---
+// 构建与 Layer 0 遍历在 P 维投影空间进行 (dimension = P)，全维 FP32 向量保存在 data_full，
+// 最终重排与精确搜索使用全维距离。投影不减均值: 平移不改变 L2 距离。
+
+// Gram-Schmidt 正交化 rows x cols 矩阵的各行
+static void orthonormalize_rows(float *m, int rows, int cols)
+{
+    for (int r = 0; r < rows; ++r)
+    {
+        float *row = &m[(size_t)r * cols];
+        for (int p = 0; p < r; ++p)
+        {
+            const float *prev = &m[(size_t)p * cols];
+            float dot = 0.0f;
+            for (int j = 0; j < cols; ++j)
+                dot += row[j] * prev[j];
+            for (int j = 0; j < cols; ++j)
+                row[j] -= dot * prev[j];
+        }
+        float norm = sqrt(squared_norm(row, cols));
+        for (int j = 0; j < cols; ++j)
+            row[j] /= norm;
+    }
+}
+
+// 随机正交行 (高斯矩阵 Gram-Schmidt)
+static void random_orthonormal_rows(int rows, int cols, unsigned seed, vector<float> &out)
+{
+    std::mt19937 rng(seed);
+    std::normal_distribution<float> gauss(0.0f, 1.0f);
+    out.resize((size_t)rows * cols);
+    for (auto &x : out)
+        x = gauss(rng);
+    orthonormalize_rows(out.data(), rows, cols);
+}
+
+// 训练投影矩阵 (P x d，行正交)，返回保留的方差比例
+float Solution::train_projection(const vector<float> &base, int d)
+{
+    const int n = base.size() / d;
+    const int p = proj_dims_cfg;
+
+    // 1. 采样协方差
+    int sample_size = min(n, PROJ_SAMPLE);
+    std::mt19937 rng(PROJ_SEED);
+    vector<int> sample_ids(sample_size);
+    for (int i = 0; i < sample_size; ++i)
+    {
+        std::uniform_int_distribution<int> pick(0, n - 1);
+        sample_ids[i] = sample_size == n ? i : pick(rng);
+    }
+    vector<double> mean(d, 0.0);
+    for (int id : sample_ids)
+        for (int j = 0; j < d; ++j)
+            mean[j] += base[(size_t)id * d + j];
+    for (int j = 0; j < d; ++j)
+        mean[j] /= sample_size;
+
+    vector<float> cov((size_t)d * d, 0.0f);
+    executor().parallel_for(0, d, 8, [&](int a, int)
+    {
+        vector<float> col(sample_size);
+        for (int i = 0; i < sample_size; ++i)
+            col[i] = base[(size_t)sample_ids[i] * d + a] - (float)mean[a];
+        for (int b = a; b < d; ++b)
+        {
+            double s = 0.0;
+            for (int i = 0; i < sample_size; ++i)
+                s += col[i] * (base[(size_t)sample_ids[i] * d + b] - (float)mean[b]);
+            cov[(size_t)a * d + b] = cov[(size_t)b * d + a] = (float)(s / max(1, sample_size - 1));
+        }
+    });
+    double total_var = 0.0;
+    for (int j = 0; j < d; ++j)
+        total_var += cov[(size_t)j * d + j];
+
+    // 2. 随机投影直接取随机正交行；PCA 用子空间迭代求前 P 个主方向
+    random_orthonormal_rows(p, d, PROJ_SEED, proj_matrix);
+    if (!proj_random)
+    {
+        vector<float> next((size_t)p * d);
+        for (int iter = 0; iter < PROJ_PCA_ITERS; ++iter)
+        {
+            executor().parallel_for(0, p, 1, [&](int r, int)
+            {
+                const float *q = &proj_matrix[(size_t)r * d];
+                for (int a = 0; a < d; ++a)
+                {
+                    const float *row = &cov[(size_t)a * d];
+                    float s = 0.0f;
+#pragma omp simd reduction(+ : s)
+                    for (int b = 0; b < d; ++b)
+                        s += row[b] * q[b];
+                    next[(size_t)r * d + a] = s;
+                }
+            });
+            orthonormalize_rows(next.data(), p, d);
+            proj_matrix.swap(next);
+        }
+    }
+
+    // 3. 保留方差 = sum(q^T C q) / trace(C)
+    double kept = 0.0;
+    for (int r = 0; r < p; ++r)
+    {
+        const float *q = &proj_matrix[(size_t)r * d];
+        for (int a = 0; a < d; ++a)
+        {
+            float s = 0.0f;
+            for (int b = 0; b < d; ++b)
+                s += cov[(size_t)a * d + b] * q[b];
+            kept += (double)q[a] * s;
+        }
+    }
+    return total_var > 0.0 ? (float)min(1.0, kept / total_var) : 1.0f;
+}
+
+void Solution::project_vector(const float *src, float *dst) const
+{
+    for (int r = 0; r < dimension; ++r)
+    {
+        const float *row = &proj_matrix[(size_t)r * full_dimension];
+        float s = 0.0f;
+#pragma omp simd reduction(+ : s)
+        for (int j = 0; j < full_dimension; ++j)
+            s += row[j] * src[j];
+        dst[r] = s;
+    }
+}
+
+// 各维方差降序排列的维度下标 (采样估计)
+vector<int> Solution::variance_order(const vector<float> &base, int d)
+{
+    const int n = base.size() / d;
+    const int step = max(1, n / PROJ_SAMPLE);
+    vector<double> sum(d, 0.0), sum_sq(d, 0.0);
+    int count = 0;
+    for (int i = 0; i < n; i += step, ++count)
+    {
+        for (int j = 0; j < d; ++j)
+        {
+            double v = base[(size_t)i * d + j];
+            sum[j] += v;
+            sum_sq[j] += v * v;
+        }
+    }
+    vector<double> var(d);
+    for (int j = 0; j < d; ++j)
+        var[j] = sum_sq[j] / count - (sum[j] / count) * (sum[j] / count);
+    vector<int> order(d);
+    for (int j = 0; j < d; ++j)
+        order[j] = j;
+    stable_sort(order.begin(), order.end(), [&](int a, int b) { return var[a] > var[b]; });
+    return order;
+}
+
+// 索引空间中的全维查询: 维度重排时按 dim_order 收集到 buf，否则为原查询
+const float *Solution::index_query(const float *query, vector<float> &buf) const
+{
+    if (dim_order.empty())
+        return query;
+    buf.resize(dimension);
+    for (int j = 0; j < dimension; ++j)
+        buf[j] = query[dim_order[j]];
+    return buf.data();
+}
+
+// 遍历用查询: 投影模式下为线程局部的投影结果，否则为 index_query
+const float *Solution::traversal_query(const float *query) const
+{
+    if (data_full.empty())
+        return index_query(query, tls_projected_query);
+    tls_projected_query.resize(dimension);
+    project_vector(query, tls_projected_query.data());
+    return tls_projected_query.data();
+}
+
+// 全维精确距离 (重排与精确搜索): 投影模式用 data_full，否则同 rerank 的 FP32 / 存储格式路径
+float Solution::dist_full(const float *query, int id) const
+{
+    if (!data_full.empty())
+        return dist_l2_float_avx(query, &data_full[(size_t)id * full_dimension], full_dimension);
+    if (!data_flat.empty())
+        return dist_l2_float_avx(query, &data_flat[(size_t)id * dimension], dimension);
+    return dist_query(query, id);
+}
+
+// --- 1-bit 二值码 (Layer 0 遍历用) ---
+// 每维 1 bit: (可选随机正交旋转后) 分量大于阈值记 1，阈值为各维均值或 0 (符号)。
+// Layer 0 遍历用 popcount Hamming 距离，候选再经 SQ8 与 FP32 两级重排。
+
+// Hamming 距离: 8 个字以上用 VPOPCNTDQ / AVX2 (pshufb 半字节查表)，尾部标量
+static inline int hamming_distance(const uint64_t *a, const uint64_t *b, int words)
+{
+    int i = 0;
+    int total = 0;
+#if defined(__AVX512VPOPCNTDQ__) && defined(__AVX512F__)
+    if (words >= 8)
+    {
+        __m512i acc = _mm512_setzero_si512();
+        for (; i + 8 <= words; i += 8)
+        {
+            __m512i x = _mm512_xor_si512(_mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i));
+            acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(x));
+        }
+        uint64_t lanes[8];
+        _mm512_storeu_si512(lanes, acc);
+        for (int l = 0; l < 8; ++l)
+            total += (int)lanes[l];
+    }
+#elif defined(__AVX2__)
+    if (words >= 4)
+    {
+        const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                                0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+        const __m256i low_mask = _mm256_set1_epi8(0x0f);
+        __m256i acc = _mm256_setzero_si256();
+        for (; i + 4 <= words; i += 4)
+        {
+            __m256i x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(a + i)),
+                                         _mm256_loadu_si256((const __m256i *)(b + i)));
+            __m256i lo = _mm256_shuffle_epi8(lookup, _mm256_and_si256(x, low_mask));
+            __m256i hi = _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(x, 4), low_mask));
+            acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256()));
+        }
+        uint64_t lanes[4];
+        _mm256_storeu_si256((__m256i *)lanes, acc);
+        total += (int)(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+    }
+#endif
+    for (; i < words; ++i)
+        total += __builtin_popcountll(a[i] ^ b[i]);
+    return total;
+}
+
+void Solution::encode_binary(const float *src, uint64_t *dst) const
+{
+    const float *v = src;
+    if (!binary_rotation.empty())
+    {
+        tls_binary_rotated.resize(dimension);
+        for (int r = 0; r < dimension; ++r)
+        {
+            const float *row = &binary_rotation[(size_t)r * dimension];
+            float s = 0.0f;
+#pragma omp simd reduction(+ : s)
+            for (int j = 0; j < dimension; ++j)
+                s += row[j] * src[j];
+            tls_binary_rotated[r] = s;
+        }
+        v = tls_binary_rotated.data();
+    }
+    memset(dst, 0, binary_words * sizeof(uint64_t));
+    for (int j = 0; j < dimension; ++j)
+    {
+        if (v[j] > binary_threshold[j])
+            dst[j >> 6] |= 1ULL << (j & 63);
+    }
+}
+
+void Solution::build_binary_codes()
+{
+    huge_vector<uint64_t>().swap(data_binary);
+    vector<float>().swap(binary_threshold);
+    vector<float>().swap(binary_rotation);
+    binary_words = 0;
+    if (!binary_enabled || num_vectors == 0)
+        return;
+
+    // 1. 随机正交旋转 (高斯矩阵 Gram-Schmidt 正交化)
+    if (binary_rotate)
+        random_orthonormal_rows(dimension, dimension, BINARY_ROTATION_SEED, binary_rotation);
+
+    // 2. 阈值: 旋转后各维均值 (或 0)
+    binary_threshold.assign(dimension, 0.0f);
+    binary_words = (dimension + 63) / 64;
+    if (binary_mean_threshold)
+    {
+        vector<double> sums(dimension, 0.0);
+        vector<float> buf(dimension);
+        for (int i = 0; i < num_vectors; ++i)
+        {
+            const float *v = get_vector(i, buf.data());
+            for (int j = 0; j < dimension; ++j)
+                sums[j] += v[j];
+        }
+        // 均值经过线性旋转仍是均值
+        vector<float> mean(dimension);
+        for (int j = 0; j < dimension; ++j)
+            mean[j] = (float)(sums[j] / num_vectors);
+        if (binary_rotation.empty())
+        {
+            binary_threshold = mean;
+        }
+        else
+        {
+            for (int r = 0; r < dimension; ++r)
+            {
+                float s = 0.0f;
+                for (int j = 0; j < dimension; ++j)
+                    s += binary_rotation[(size_t)r * dimension + j] * mean[j];
+                binary_threshold[r] = s;
+            }
+        }
+    }
+
+    // 3. 编码
+    data_binary.resize((size_t)num_vectors * binary_words);
+    executor().parallel_for(0, num_vectors, 1024, [&](int i, int)
+    {
+        tls_decode_buf.resize(dimension);
+        encode_binary(get_vector(i, tls_decode_buf.data()), &data_binary[(size_t)i * binary_words]);
+    });
+}
+
+// --- 4-bit fast-scan PQ (Layer 0 邻居块) ---
+// 维度切成 pq4_subspaces 段，每段 16 个质心 (4 bit)。每个节点的 Layer 0 邻居按 32 个一块，
+// 块内按子空间存放 16 字节: 第 j 字节低 4 位为邻居 j 的码，高 4 位为邻居 j + 16 的码。
+// 查询时每段 16 项距离表量化为 uint8，pshufb 一次查出 32 个邻居在该段的距离，16 位累加。
+// 估计距离明显大于结果集最差距离的邻居不再计算精确距离。
+
+void Solution::build_pq4_codes()
+{
+    vector<int>().swap(pq4_sub_begin);
+    vector<float>().swap(pq4_centroids);
+    huge_vector<uint8_t>().swap(pq4_blocks);
+    huge_vector<size_t>().swap(pq4_block_offsets);
+    pq4_subspaces = 0;
+    if (pq4_subspaces_cfg == 0 || num_vectors == 0 || final_graph_offsets.empty())
+        return;
+
+    // 1. 子空间划分 (自动: 每段 2 维；段数受 16 位累加上限约束)
+    int m = pq4_subspaces_cfg > 0 ? pq4_subspaces_cfg : (dimension + 1) / 2;
+    m = max(1, min(min(m, dimension), PQ4_MAX_SUBSPACES));
+    pq4_subspaces = m;
+    pq4_sub_begin.resize(m + 1);
+    for (int s = 0; s <= m; ++s)
+        pq4_sub_begin[s] = (int)((long long)dimension * s / m);
+
+    // 2. 每段训练 16 个质心 (采样)
+    int sample_size = min(num_vectors, PQ4_TRAIN_SAMPLE);
+    std::mt19937 rng(PQ4_SEED);
+    vector<int> sample_ids(sample_size);
+    for (int i = 0; i < sample_size; ++i)
+    {
+        std::uniform_int_distribution<int> pick(0, num_vectors - 1);
+        sample_ids[i] = sample_size == num_vectors ? i : pick(rng);
+    }
+    vector<float> sample((size_t)sample_size * dimension);
+    executor().parallel_for(0, sample_size, 64, [&](int i, int)
+    {
+        float *dst = &sample[(size_t)i * dimension];
+        const float *v = get_vector(sample_ids[i], dst);
+        if (v != dst)
+            memcpy(dst, v, dimension * sizeof(float));
+    });
+
+    // pq4_centroids: 段 s 的质心 c 位于 [pq4_sub_begin[s] * 16 + c * len, ...)
+    pq4_centroids.assign((size_t)dimension * PQ4_KSUB, 0.0f);
+    const int ksub = min(PQ4_KSUB, sample_size);
+    for (int s = 0; s < m; ++s)
+    {
+        const int begin = pq4_sub_begin[s], len = pq4_sub_begin[s + 1] - begin;
+        vector<float> sub((size_t)sample_size * len);
+        for (int i = 0; i < sample_size; ++i)
+            memcpy(&sub[(size_t)i * len], &sample[(size_t)i * dimension + begin], len * sizeof(float));
+        vector<float> centroids;
+        train_kmeans(sub.data(), sample_size, len, ksub, PQ4_KMEANS_ITERS, PQ4_SEED + s, centroids,
+                     &executor());
+        memcpy(&pq4_centroids[(size_t)begin * PQ4_KSUB], centroids.data(), centroids.size() * sizeof(float));
+        // 样本不足 16 个时其余质心复制第一个
+        for (int c = ksub; c < PQ4_KSUB; ++c)
+            memcpy(&pq4_centroids[(size_t)begin * PQ4_KSUB + (size_t)c * len], centroids.data(), len * sizeof(float));
+    }
+
+    // 3. 每个向量的码
+    vector<uint8_t> codes((size_t)num_vectors * m);
+    executor().parallel_for(0, num_vectors, 1024, [&](int i, int)
+    {
+        tls_decode_buf.resize(dimension);
+        const float *v = get_vector(i, tls_decode_buf.data());
+        for (int s = 0; s < m; ++s)
+        {
+            const int begin = pq4_sub_begin[s], len = pq4_sub_begin[s + 1] - begin;
+            codes[(size_t)i * m + s] =
+                (uint8_t)nearest_centroid(v + begin, &pq4_centroids[(size_t)begin * PQ4_KSUB], PQ4_KSUB, len);
+        }
+    });
+
+    // 4. 按邻居块打包
+    const size_t block_bytes = (size_t)m * 16;
+    pq4_block_offsets.resize(num_vectors);
+    size_t total = 0;
+    int adj_buf[ADJ_DECODE_CAPACITY];
+    for (int i = 0; i < num_vectors; ++i)
+    {
+        pq4_block_offsets[i] = total;
+        int count;
+        layer0_neighbors(i, adj_buf, count);
+        total += (size_t)((count + PQ4_BLOCK - 1) / PQ4_BLOCK) * block_bytes;
+    }
+    pq4_blocks.assign(total, 0);
+    executor().parallel_for(0, num_vectors, 256, [&](int i, int)
+    {
+        int adj_nbs[ADJ_DECODE_CAPACITY];
+        int count;
+        const int *nbs = layer0_neighbors(i, adj_nbs, count);
+        uint8_t *dst = &pq4_blocks[pq4_block_offsets[i]];
+        for (int j = 0; j < count; ++j)
+        {
+            uint8_t *block = dst + (size_t)(j / PQ4_BLOCK) * block_bytes;
+            int lane = j % PQ4_BLOCK;
+            for (int s = 0; s < m; ++s)
+            {
+                uint8_t code = codes[(size_t)nbs[j] * m + s];
+                if (lane < 16)
+                    block[s * 16 + lane] |= code;
+                else
+                    block[s * 16 + lane - 16] |= (uint8_t)(code << 4);
+            }
+        }
+    });
+}
+
+// 查询距离表: 每段 16 项 L2 距离，按全局比例量化为 uint8 (减去每段最小值)
+// 估计距离 = lut_bias + sum(量化值) * lut_scale
+void Solution::build_pq4_lut(const float *query, uint8_t *lut, float &lut_bias, float &lut_scale) const
+{
+    const int m = pq4_subspaces;
+    tls_pq4_lut_float.resize((size_t)m * PQ4_KSUB);
+    float *dist = tls_pq4_lut_float.data();
+    float max_range = 0.0f;
+    lut_bias = 0.0f;
+    for (int s = 0; s < m; ++s)
+    {
+        const int begin = pq4_sub_begin[s], len = pq4_sub_begin[s + 1] - begin;
+        float lo = std::numeric_limits<float>::max(), hi = 0.0f;
+        for (int c = 0; c < PQ4_KSUB; ++c)
+        {
+            const float *centroid = &pq4_centroids[(size_t)begin * PQ4_KSUB + (size_t)c * len];
+            float d = 0.0f;
+            for (int j = 0; j < len; ++j)
+            {
+                float diff = query[begin + j] - centroid[j];
+                d += diff * diff;
+            }
+            dist[s * PQ4_KSUB + c] = d;
+            lo = min(lo, d);
+            hi = max(hi, d);
+        }
+        for (int c = 0; c < PQ4_KSUB; ++c)
+            dist[s * PQ4_KSUB + c] -= lo;
+        lut_bias += lo;
+        max_range = max(max_range, hi - lo);
+    }
+    lut_scale = max_range > 0.0f ? max_range / 255.0f : 1.0f;
+    const float inv = 1.0f / lut_scale;
+    for (int i = 0; i < m * PQ4_KSUB; ++i)
+        lut[i] = (uint8_t)min(255.0f, dist[i] * inv + 0.5f);
+}
+
+// 对节点 id 的全部 Layer 0 邻居打分 (量化距离和，与 final_graph_flat 中的顺序一致)
+void Solution::pq4_scan_neighbors(int id, int count, const uint8_t *lut, uint16_t *out) const
+{
+    const int m = pq4_subspaces;
+    const size_t block_bytes = (size_t)m * 16;
+    const uint8_t *blocks = &pq4_blocks[pq4_block_offsets[id]];
+    for (int b = 0; b * PQ4_BLOCK < count; ++b)
+    {
+        const uint8_t *block = blocks + b * block_bytes;
+        uint16_t *dst = out + b * PQ4_BLOCK;
+#if defined(__AVX2__)
+        const __m256i low_mask = _mm256_set1_epi8(0x0f);
+        __m256i acc_lo = _mm256_setzero_si256(); // 邻居 0..15
+        __m256i acc_hi = _mm256_setzero_si256(); // 邻居 16..31
+        for (int s = 0; s < m; ++s)
+        {
+            __m256i table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(lut + s * 16)));
+            __m128i packed = _mm_loadu_si128((const __m128i *)(block + s * 16));
+            __m256i idx = _mm256_and_si256(
+                _mm256_set_m128i(_mm_srli_epi16(packed, 4), packed), low_mask);
+            __m256i d = _mm256_shuffle_epi8(table, idx);
+            acc_lo = _mm256_add_epi16(acc_lo, _mm256_cvtepu8_epi16(_mm256_castsi256_si128(d)));
+            acc_hi = _mm256_add_epi16(acc_hi, _mm256_cvtepu8_epi16(_mm256_extracti128_si256(d, 1)));
+        }
+        _mm256_storeu_si256((__m256i *)dst, acc_lo);
+        _mm256_storeu_si256((__m256i *)(dst + 16), acc_hi);
+#else
+        for (int lane = 0; lane < PQ4_BLOCK; ++lane)
+        {
+            uint16_t sum = 0;
+            for (int s = 0; s < m; ++s)
+            {
+                uint8_t packed = block[s * 16 + (lane & 15)];
+                uint8_t code = lane < 16 ? (packed & 0x0f) : (packed >> 4);
+                sum += lut[s * 16 + code];
+            }
+            dst[lane] = sum;
+        }
+#endif
+    }
+}
+
+// --- 搜索层逻辑 ---
+
+// 构建期并发读取: 在节点锁内把第 lc 层邻居表拷贝到线程局部缓冲 (下次调用前有效)
+static thread_local vector<int> tls_locked_neighbors;
+
+inline const vector<int> &Solution::locked_neighbors(int id, int lc, vector<std::mutex> &node_locks) const
+{
+    std::lock_guard<std::mutex> lock(node_locks[id]);
+    tls_locked_neighbors = nodes[id].neighbors[lc];
+    return tls_locked_neighbors;
+}
+
+// 构建阶段使用的搜索 (精确距离，操作动态图)
+// 返回 (距离, id) 升序，供 RobustPrune 直接使用，避免调用方重算距离
+void Solution::search_layer_build(const float *query, vector<pair<float, int>> &candidates,
+                                  const vector<int> &ep, int ef, int lc, vector<std::mutex> *node_locks) const
+{
+    tls_visited.prepare(num_vectors);
+
+    // 优先队列逻辑 (使用std::priority_queue会慢，这里用简单的排序数组或堆)
+    // 为保持代码简洁且遵循指南，使用标准的最小/最大堆逻辑
     // 为了极致性能，这里手动维护两个集合:
     // C: 待探索集合 (min-heap by distance)
     // W: 结果集合 (max-heap by distance, size <= ef)
 
-    priority_queue<pair<float, int>, vector<pair<float, int>>, greater<pair<float, int>>> C;
-    priority_queue<pair<float, int>> W;
+    priority_queue<pair<float, int>, vector<pair<float, int>>, greater<pair<float, int>>> C;
+    priority_queue<pair<float, int>> W;
+
+    // 初始化入口点
+    for (int pid : ep)
+    {
+        if (!tls_visited.is_visited(pid))
+        {
+            tls_visited.mark(pid);
+            float dist = dist_query(query, pid);
+            C.push({dist, pid});
+            W.push({dist, pid});
+            if (W.size() > ef)
+                W.pop();
+        }
+    }
+
+    while (!C.empty())
+    {
+        auto curr = C.top();
+        C.pop();
+        float dist_c = curr.first;
+        int id_c = curr.second;
+
+        if (dist_c > W.top().first)
+            break; // 剪枝
+
+        // 遍历邻居 (并发插入时在锁内拷贝: connect_reverse 可能正在改写或扩容该表)
+        const vector<int> &neighbors = node_locks ? locked_neighbors(id_c, lc, *node_locks)
+                                                  : nodes[id_c].neighbors[lc];
+
+        // 预取优化 (Optimization 6): 提前 pf_distance 个邻居预取整条向量
+        const int count = (int)neighbors.size();
+        for (int i = 0; i < pf_distance && i < count; ++i)
+            prefetch_vector(neighbors[i]);
+
+        for (int i = 0; i < count; ++i)
+        {
+            if (pf_distance > 0 && i + pf_distance < count &&
+                !tls_visited.is_visited(neighbors[i + pf_distance]))
+                prefetch_vector(neighbors[i + pf_distance]);
+
+            int nid = neighbors[i];
+            if (tls_visited.is_visited(nid))
+                continue;
+            tls_visited.mark(nid);
+
+            float d = dist_query(query, nid);
+
+            if (W.size() < ef || d < W.top().first)
+            {
+                W.push({d, nid});
+                C.push({d, nid});
+                if (W.size() > ef)
+                    W.pop();
+            }
+        }
+    }
+
+    // 收集结果 (连同距离)
+    candidates.resize(W.size());
+    // W pop出来是降序，倒序写入得到升序
+    for (int pos = (int)W.size() - 1; pos >= 0; --pos)
+    {
+        candidates[pos] = W.top();
+        W.pop();
+    }
+}
+
+// 最终查询阶段使用的搜索 (Layer 0使用量化 + 扁平图)
+// [修复版本] 使用标准HNSW双堆逻辑，避免搜索提前终止
+void Solution::search_layer_query(const float *query, const unsigned char *query_quant,
+                                  vector<int> &candidates, const vector<int> &ep,
+                                  int ef, int lc) const
+{
+
+    tls_visited.prepare(num_vectors);
+
+    // 使用数组模拟堆，比STL快 (Optimization 5)
+    // W_arr: 结果集 (维持有序)
+    // 关键修复: 扩大缓冲区以支持 EF_SEARCH=800
+    Candidate W_arr[2048]; // 支持 ef <= 800+ (安全余地)
+    int adj_buf[ADJ_DECODE_CAPACITY]; // 压缩邻接表的解码缓冲
+    int W_size = 0;
+
+    // 辅助: 插入W
+    // 返回插入位置 (未插入返回 ef)，用于自适应终止判断 top-k 是否变化
+    auto add_to_W = [&](int id, float d) -> int
+    {
+        if (W_size < ef || d < W_arr[W_size - 1].dist)
+        {
+            // 插入排序
+            int pos = W_size;
+            if (W_size < ef)
+                W_size++;
+
+            while (pos > 0 && W_arr[pos - 1].dist > d)
+            {
+                if (pos < ef)
+                    W_arr[pos] = W_arr[pos - 1];
+                pos--;
+            }
+            if (pos < ef)
+                W_arr[pos] = {d, id};
+            return pos;
+        }
+        return ef;
+    };
+
+    // 自适应终止: top-k 连续 adaptive_patience 次扩展未变化即停止 (仅 Layer 0)
+    const int patience = (lc == 0) ? adaptive_patience : 0;
+    int stable_expansions = 0;
+
+    // 二值码遍历: Layer 0 改用 Hamming 距离 (结果由调用方经 SQ8 / FP32 重排)
+    const bool binary = (lc == 0) && !data_binary.empty();
+    const uint64_t *q_bits = nullptr;
+    if (binary)
+    {
+        tls_query_bits.resize(binary_words);
+        encode_binary(query, tls_query_bits.data());
+        q_bits = tls_query_bits.data();
+    }
+    // 结果集已满时以当前最差距离为界提前终止距离计算
+    auto traversal_dist = [&](int id) -> float
+    {
+        if (binary)
+            return (float)hamming_distance(q_bits, &data_binary[(size_t)id * binary_words], binary_words);
+        if (lc == 0 && W_size == ef)
+            return dist_query_bounded(query, id, W_arr[W_size - 1].dist);
+        return dist_query(query, id);
+    };
+    // fast-scan: 展开节点时先用 4-bit PQ 给整个邻居表打分，过滤明显过远的邻居
+    const bool fastscan = (lc == 0) && !binary && !pq4_blocks.empty();
+    float pq4_bias = 0.0f, pq4_scale = 1.0f;
+    if (fastscan)
+    {
+        tls_pq4_lut.resize((size_t)pq4_subspaces * PQ4_KSUB);
+        build_pq4_lut(query, tls_pq4_lut.data(), pq4_bias, pq4_scale);
+        tls_pq4_scores.resize(((M_max0 + PQ4_BLOCK - 1) / PQ4_BLOCK) * PQ4_BLOCK);
+    }
+    auto prefetch_code = [&](int id)
+    {
+        if (binary)
+            _mm_prefetch((const char *)&data_binary[(size_t)id * binary_words], _MM_HINT_T0);
+        else
+            prefetch_vector(id);
+    };
+
+    // [性能重构] 替代 priority_queue：使用 thread_local vector + 手动堆管理
+    // 优势：零内存分配 (Zero Allocation)，消除动态内存开销
+    tls_candidate_queue.clear();
+
+    // 初始化
+    for (int pid : ep)
+    {
+        if (!tls_visited.is_visited(pid))
+        {
+            tls_visited.mark(pid);
+            float d;
+            // 关键修复：为提升召回率，Layer 0 也使用 Float 精确距离
+            // 量化距离误差会导致候选集质量下降，影响召回率
+            d = traversal_dist(pid);
+            add_to_W(pid, d);
+            tls_candidate_queue.push_back({d, pid});
+        }
+    }
+    // 建立最小堆
+    make_heap(tls_candidate_queue.begin(), tls_candidate_queue.end(), greater<pair<float, int>>());
+
+    while (!tls_candidate_queue.empty())
+    {
+        // 取堆顶（最小距离的候选点）
+        pop_heap(tls_candidate_queue.begin(), tls_candidate_queue.end(), greater<pair<float, int>>());
+        auto curr = tls_candidate_queue.back();
+        tls_candidate_queue.pop_back();
+
+        float dist_c = curr.first;
+        int nid = curr.second;
+
+        // 剪枝：当前最近的候选点比结果集中最远的点还远，且结果集已满
+        if (W_size == ef && dist_c > W_arr[W_size - 1].dist)
+            break;
+
+        // 获取邻居指针
+        const int *neighbors_ptr;
+        int neighbors_count;
+
+        if (lc == 0)
+        {
+            // Layer 0: 从扁平数组读取 (Optimization 4)，压缩时解码
+            neighbors_ptr = layer0_neighbors(nid, adj_buf, neighbors_count);
+
+            // 预取下一个堆顶的邻接记录，展开当前点期间完成加载
+            if (pf_distance > 0 && !tls_candidate_queue.empty())
+                prefetch_adjacency(tls_candidate_queue.front().second);
+        }
+        else
+        {
+            // High Layer: 从节点对象读取
+            const auto &vec = nodes[nid].neighbors[lc];
+            neighbors_ptr = vec.data();
+            neighbors_count = (int)vec.size();
+        }
+
+        // 预取前 pf_distance 个未访问邻居的整条向量
+        for (int i = 0; i < pf_distance && i < neighbors_count; ++i)
+        {
+            if (!tls_visited.is_visited(neighbors_ptr[i]))
+                prefetch_code(neighbors_ptr[i]);
+        }
+
+        float pq4_bound = std::numeric_limits<float>::max();
+        if (fastscan && W_size == ef)
+        {
+            pq4_scan_neighbors(nid, neighbors_count, tls_pq4_lut.data(), tls_pq4_scores.data());
+            pq4_bound = W_arr[W_size - 1].dist * PQ4_SLACK;
+        }
+
+        bool topk_changed = false;
+        for (int i = 0; i < neighbors_count; ++i)
+        {
+            // Prefetch - 流水线保持 pf_distance 个邻居在途
+            if (pf_distance > 0 && i + pf_distance < neighbors_count &&
+                !tls_visited.is_visited(neighbors_ptr[i + pf_distance]))
+            {
+                prefetch_code(neighbors_ptr[i + pf_distance]);
+            }
+
+            int neighbor_id = neighbors_ptr[i];
+            if (tls_visited.is_visited(neighbor_id))
+                continue;
+
+            // fast-scan 过滤 (只有估计距离足够近的邻居才计算精确距离)。被过滤的点不标记访问，
+            // 之后从其他节点到达时按当时的界重新判断: 过滤只改变计算顺序，不改变可达性
+            if (pq4_bound < std::numeric_limits<float>::max() &&
+                pq4_bias + tls_pq4_scores[i] * pq4_scale > pq4_bound)
+                continue;
+            tls_visited.mark(neighbor_id);
+
+            // 关键修复：始终使用 Float 精确距离计算 (二值码模式下为 Hamming)
+            float d = traversal_dist(neighbor_id);
+
+            if (W_size < ef || d < W_arr[W_size - 1].dist)
+            {
+                if (add_to_W(neighbor_id, d) < TOP_K)
+                    topk_changed = true;
+                // 手动堆 Push
+                tls_candidate_queue.push_back({d, neighbor_id});
+                push_heap(tls_candidate_queue.begin(), tls_candidate_queue.end(), greater<pair<float, int>>());
+            }
+        }
+
+        if (patience > 0 && W_size >= TOP_K)
+        {
+            stable_expansions = topk_changed ? 0 : stable_expansions + 1;
+            if (stable_expansions >= patience)
+                break;
+        }
+    }
+
+    candidates.clear();
+    for (int i = 0; i < W_size; ++i)
+    {
+        candidates.push_back(W_arr[i].id);
+    }
+}
+
+// --- 选邻居策略 (RobustPrune) ---
+// 正向选边与反向边溢出剪枝共用。
+// sorted_cand 为 (到基准点的距离, id)，按距离升序；距离均为平方 L2。
+// Vamana 规则: 若已选邻居 e 满足 alpha * d(c, e) < d(c, q)，则 c 被 e "遮挡"而丢弃。
+// 平方距离下等价于 alpha^2 * d2(c, e) < d2(c, q)；alpha = 1 即原 GAMMA 剪枝，alpha > 1 保留更多长边。
+void Solution::get_neighbors_heuristic(vector<pair<float, int>> &result, const vector<pair<float, int>> &sorted_cand,
+                                       int k) const
+{
+    result.clear();
+    const float alpha_sq = prune_alpha * prune_alpha;
+
+    // Phase 4 优化: 限制候选池大小，只考虑前 2*M 个最近的候选点
+    int max_candidates = min((int)sorted_cand.size(), k * 2);
+    for (int idx = 0; idx < max_candidates; ++idx)
+    {
+        if (result.size() >= (size_t)k)
+            break;
+        const auto &pair = sorted_cand[idx];
+        int cand_id = pair.second;
+        float dist_to_q = pair.first;
+
+        bool good = true;
+        for (const auto &exist : result)
+        {
+            int exist_id = exist.second;
+            float dist_exist = dist_nodes(cand_id, exist_id);
+            if (dist_exist * alpha_sq < dist_to_q)
+            {
+                good = false;
+                break;
+            }
+        }
+        if (good)
+            result.push_back(pair);
+    }
+}
+
+// --- 反向连接 ---
+// selected 携带到 id 的距离 (对称)，邻居表的距离存于 neighbor_dists，溢出时无需重算
+void Solution::connect_reverse(int id, const vector<pair<float, int>> &selected_neighbors, int lc, int M_limit,
+                               vector<std::mutex> &node_locks, bool dedup)
+{
+    vector<pair<float, int>> t_cand;
+    vector<pair<float, int>> pruned;
+
+    // Phase 2 优化: 减少锁内工作量
+    for (const auto &sel : selected_neighbors)
+    {
+        int neighbor_id = sel.second;
+        std::lock_guard<std::mutex> lock(node_locks[neighbor_id]);
+        vector<int> &target_neighbors = nodes[neighbor_id].neighbors[lc];
+        vector<float> &target_dists = nodes[neighbor_id].neighbor_dists[lc];
+
+        // NN-Descent / 分区合并后双向边可能已存在 (逐点插入时 id 是新点，无需查重)
+        if (dedup && find(target_neighbors.begin(), target_neighbors.end(), id) != target_neighbors.end())
+            continue;
+
+        // 快速路径: 如果未满，直接插入
+        if (target_neighbors.size() < (size_t)M_limit)
+        {
+            target_neighbors.push_back(id);
+            target_dists.push_back(sel.first);
+        }
+        else
+        {
+            // 慢速路径: 需要剪枝
+            // 与正向选边使用同一 RobustPrune，保持反向边的多样性
+            t_cand.clear();
+            for (size_t j = 0; j < target_neighbors.size(); ++j)
+            {
+                t_cand.push_back({target_dists[j], target_neighbors[j]});
+            }
+            // 添加新节点
+            t_cand.push_back(sel);
+            sort(t_cand.begin(), t_cand.end());
+
+            get_neighbors_heuristic(pruned, t_cand, M_limit);
+
+            target_neighbors.clear();
+            target_dists.clear();
+            for (const auto &p : pruned)
+            {
+                target_dists.push_back(p.first);
+                target_neighbors.push_back(p.second);
+            }
+        }
+    }
+}
+
+// 辅助：生成随机层级
+int Solution::get_random_level(float level_mult)
+{
+    // 使用 hash<thread::id> 为每个线程生成唯一种子
+    static thread_local std::mt19937 rng(12345 + std::hash<std::thread::id>{}(std::this_thread::get_id()));
+    static thread_local std::uniform_real_distribution<float> dist(0.0, 1.0);
+    float r = dist(rng);
+    return (int)(-log(r) * level_mult);
+}
+
+// 构建期高层贪婪下降: 从 ep 所在的 top_level 逐层下降到 target_level 之上，返回 target_level 的入口
+int Solution::greedy_descend(const float *query, int ep, int top_level, int target_level,
+                             vector<std::mutex> *node_locks) const
+{
+    int curr_ep = ep;
+    if (target_level >= top_level)
+        return curr_ep;
+    float min_dist = dist_query(query, curr_ep);
+    for (int lc = top_level; lc > target_level; --lc)
+    {
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            // 并发插入时其他线程可能正在写入该表 (push_back 扩容会使迭代失效)，在节点锁内拷贝
+            const vector<int> &nbs = node_locks ? locked_neighbors(curr_ep, lc, *node_locks)
+                                                : nodes[curr_ep].neighbors[lc];
+            for (int n : nbs)
+            {
+                float d = dist_query(query, n);
+                if (d < min_dist)
+                {
+                    min_dist = d;
+                    curr_ep = n;
+                    changed = true;
+                }
+            }
+        }
+    }
+    return curr_ep;
+}
+
+// --- 单点插入 ---
+// 全局入口点更新锁 (仅在出现更高层级时获取；执行器线程不一定是 OpenMP 线程)
+static std::mutex entry_update_mutex;
+
+void Solution::insert_point(int i, int level, int min_layer, vector<std::mutex> &node_locks)
+{
+    vector<float> query_buf(dimension);
+    const float *query = get_vector(i, query_buf.data());
+
+    // 入口点与最大层级一起更新，须成对读取 (否则新层级配旧入口点会越过该点的层数)
+    int cur_max_level, cur_enter_point;
+    {
+        std::lock_guard<std::mutex> lock(entry_update_mutex);
+        cur_max_level = max_level;
+        cur_enter_point = enter_point;
+    }
+
+    // 1. 贪婪搜索找到当前层级的入口点
+    int curr_ep = greedy_descend(query, cur_enter_point, cur_max_level, level, &node_locks);
+
+    // 初始化当前节点
+    // 只有当前线程访问 nodes[i]，无需锁
+    nodes[i].neighbors.resize(level + 1);
+    nodes[i].neighbor_dists.resize(level + 1);
+
+    // 2. 从 level 向下构建
+    // 需要在每层找到 ef_construction 个最近邻作为候选
+    vector<int> ep_container = {curr_ep};
+
+    for (int lc = min(level, cur_max_level); lc >= min_layer; --lc)
+    {
+        // 候选已按距离升序并携带距离，RobustPrune 直接使用
+        vector<pair<float, int>> sorted_cand;
+        search_layer_build(query, sorted_cand, ep_container, EF_CONSTRUCTION, lc, &node_locks);
+
+        // 选择邻居
+        vector<pair<float, int>> selected_neighbors;
+        int M_limit = (lc == 0) ? M_max0 : M_max;
+        get_neighbors_heuristic(selected_neighbors, sorted_cand, M_limit);
+
+        // 双向连接
+        // 1. 将 selected 连接到 i (更高层已连接时 i 可被其他线程读到，同样加锁)
+        {
+            std::lock_guard<std::mutex> lock(node_locks[i]);
+            vector<int> &own_neighbors = nodes[i].neighbors[lc];
+            vector<float> &own_dists = nodes[i].neighbor_dists[lc];
+            own_neighbors.clear();
+            own_dists.clear();
+            for (const auto &sel : selected_neighbors)
+            {
+                own_dists.push_back(sel.first);
+                own_neighbors.push_back(sel.second);
+            }
+        }
+
+        // 2. 将 i 连接到 selected 中的每个节点 (需要加锁)
+        connect_reverse(i, selected_neighbors, lc, M_limit, node_locks);
+
+        // 下一层的入口
+        ep_container.clear();
+        for (const auto &sel : selected_neighbors)
+            ep_container.push_back(sel.second);
+    }
+
+    // 更新全局入口点 (如果是更高层)
+    if (level > max_level)
+    {
+        std::lock_guard<std::mutex> lock(entry_update_mutex);
+        if (level > max_level)
+        {
+            max_level = level;
+            enter_point = i;
+        }
+    }
+}
+
+// --- 主构建流程 ---
+void Solution::build(int d, const vector<float> &base_input)
+{
+    dimension = d;
+    full_dimension = d;
+    num_vectors = base_input.size() / d;
+
+    // 降维投影: 之后的构建全部在 P 维空间进行，全维向量留作重排
+    const vector<float> *base_ptr = &base_input;
+    vector<float> projected;
+    vector<float>().swap(proj_matrix);
+    huge_vector<float>().swap(data_full);
+    proj_variance_retained = 1.0f;
+    if (proj_dims_cfg > 0 && proj_dims_cfg < d && num_vectors > 0)
+    {
+        proj_variance_retained = train_projection(base_input, d);
+        data_full.assign(base_input.begin(), base_input.end());
+        dimension = proj_dims_cfg;
+        projected.resize((size_t)num_vectors * dimension);
+        executor().parallel_for(0, num_vectors, 1024, [&](int i, int)
+                                { project_vector(&base_input[(size_t)i * d], &projected[(size_t)i * dimension]); });
+        base_ptr = &projected;
+    }
+
+    // 按方差降序重排维度，使有界距离尽早累积到大分量
+    vector<float> reordered;
+    vector<int>().swap(dim_order);
+    if (reorder_dims_cfg && num_vectors > 0)
+    {
+        vector<int> order = variance_order(*base_ptr, dimension);
+        if (!data_full.empty())
+        {
+            // 投影模式: 直接重排投影矩阵的行，查询投影结果自然有序
+            vector<float> rows(proj_matrix.size());
+            for (int r = 0; r < dimension; ++r)
+                memcpy(&rows[(size_t)r * full_dimension], &proj_matrix[(size_t)order[r] * full_dimension],
+                       full_dimension * sizeof(float));
+            proj_matrix.swap(rows);
+        }
+        else
+        {
+            dim_order = order;
+        }
+        reordered.resize(base_ptr->size());
+        executor().parallel_for(0, num_vectors, 1024, [&](int i, int)
+        {
+            const float *src = &(*base_ptr)[(size_t)i * dimension];
+            float *dst = &reordered[(size_t)i * dimension];
+            for (int j = 0; j < dimension; ++j)
+                dst[j] = src[order[j]];
+        });
+        base_ptr = &reordered;
+        vector<float>().swap(projected);
+    }
+    const vector<float> &base = *base_ptr;
+
+    // 半精度模式: 基向量只存 FP16/BF16；FP32 副本仅在需要精确重排时保留
+    if (vector_storage == STORAGE_FP32 || keep_fp32_rerank)
+        data_flat.assign(base.begin(), base.end());
+    else
+        huge_vector<float>().swap(data_flat);
+    if (vector_storage != STORAGE_FP32)
+    {
+        data_half.resize((size_t)num_vectors * dimension);
+        executor().parallel_for(0, num_vectors, 1024, [&](int i, int)
+        {
+            encode_half(&base[(size_t)i * dimension], &data_half[(size_t)i * dimension]);
+        });
+    }
+    else
+    {
+        huge_vector<uint16_t>().swap(data_half);
+    }
+
+    // 重建后旧副本、缓存结果与磁盘索引失效
+    disable_numa_replicas();
+    clear_result_cache();
+    disk.reset();
+
+    // 参数初始化
+    M_max = M;
+    M_max0 = M * 2;
+    max_level = 0;
+    enter_point = 0;
+    configure_prefetch();
+
+    // 初始化节点 (重建时丢弃旧图)
+    vector<Node>(num_vectors).swap(nodes);
+
+    // Phase 3 优化: 预分配内存减少动态分配
+    // 预估每个节点的最大层级约为 log(N)/log(2) ~= 20 层
+    for (int i = 0; i < num_vectors; ++i)
+    {
+        nodes[i].neighbors.reserve(max(5, (int)(log(num_vectors) / log(2.0))));
+    }
+
+    // 锁 (每个节点一把锁) - 使用 std::mutex 替代 omp_lock_t
+    vector<std::mutex> node_locks(num_vectors);
+
+    if (build_mode == BUILD_NN_DESCENT)
+        build_nn_descent(node_locks);
+    else if (build_mode == BUILD_HNSW_WAVES)
+        build_hnsw_waves();
+    else if (build_mode == BUILD_PARTITIONED)
+        build_partitioned(node_locks);
+    else
+        build_hnsw_insert(node_locks);
+
+    // 邻居距离仅构建期使用
+    for (int i = 0; i < num_vectors; ++i)
+    {
+        vector<vector<float>>().swap(nodes[i].neighbor_dists);
+    }
+
+    // 构建后优化：Layer 0 扁平化
+    flatten_layer0();
+
+    // 构建后优化：标量量化 (SQ)
+    init_quantization();
+
+    // 基向量范数 (精确 kNN 引擎)
+    data_norms.resize(num_vectors);
+    executor().parallel_for(0, num_vectors, 1024, [&](int i, int)
+    {
+        tls_decode_buf.resize(dimension);
+        if (!data_full.empty())
+        {
+            data_norms[i] = squared_norm(&data_full[(size_t)i * full_dimension], full_dimension);
+            return;
+        }
+        const float *v = data_flat.empty() ? get_vector(i, tls_decode_buf.data()) : &data_flat[(size_t)i * dimension];
+        data_norms[i] = squared_norm(v, dimension);
+    });
+
+    // 二值码 (Layer 0 遍历)
+    build_binary_codes();
+
+    // 4-bit fast-scan PQ 邻居块 (依赖扁平化图)
+    build_pq4_codes();
+
+    // 紧凑高层 (SQ8 副本依赖量化)
+    build_upper_layers();
+
+    // 入口点表 (依赖扁平化图与量化)
+    build_entry_table();
+
+    // 压缩 Layer 0 邻接表 (上述步骤都经 layer0_neighbors 读取，放在最后只为构建期走未压缩路径)
+    if (compress_adjacency_cfg && M_max0 <= 255)
+        compress_layer0();
+}
+
+// 分区子图: 只用给定的 FP32 向量做 HNSW 插入，停在各层邻接表 (不扁平化、不量化，
+// 也不做范数/二值码/紧凑高层等查询期后处理)
+void Solution::build_graph_only(int d, huge_vector<float> &&vectors)
+{
+    dimension = d;
+    full_dimension = d;
+    num_vectors = (int)(vectors.size() / d);
+    data_flat = std::move(vectors);
+    M_max = M;
+    M_max0 = M * 2;
+    max_level = 0;
+    enter_point = 0;
+    configure_prefetch();
+    vector<Node>(num_vectors).swap(nodes);
+    if (num_vectors == 0)
+        return;
+    vector<std::mutex> node_locks(num_vectors);
+    build_hnsw_insert(node_locks);
+}
+
+// 默认模式：逐点 HNSW 插入
+void Solution::build_hnsw_insert(vector<std::mutex> &node_locks)
+{
+    // 第一个点
+    int level0 = get_random_level(ML);
+    nodes[0].neighbors.resize(level0 + 1);
+    nodes[0].neighbor_dists.resize(level0 + 1);
+    max_level = level0;
+    enter_point = 0;
+
+    // 并行构建 (执行器动态分块；线程局部随机数生成器在 get_random_level 中处理，
+    // 访问缓存由 search_layer_build 按线程准备)
+    executor().parallel_for(1, num_vectors, 128,
+                            [&](int i, int) { insert_point(i, get_random_level(ML), 0, node_locks); });
+}
+
+// --- 分层预分配 + 波次批量插入构建模式 ---
+// 1. 预先为所有点抽取层级，按层级降序排列 (最高层节点作为固定入口，之后 max_level 不再变化)
+// 2. 按该顺序分波次插入，波次大小前缀倍增 (不超过已插入数)，上限 HNSW_WAVE_MAX_FRACTION * N
+// 3. 每个波次分两阶段:
+//    a) 并行搜索: 在冻结的图快照上为波次内每个点逐层搜索候选并 RobustPrune，只写该点自己的邻接表
+//       (波次内的点尚无入边，其他线程不可达)，不加锁
+//    b) 批量提交: 反向边按 (层, 目标点) 分桶，每个目标点由一个任务一次性合并、必要时剪枝，无锁
+
+// 反向边 (提交阶段的临时结构)
+struct WaveEdge
+{
+    int target;
+    int source;
+    float dist;
+};
+
+void Solution::build_hnsw_waves()
+{
+    const int N = num_vectors;
+
+    // 1. 预分配层级
+    vector<int> levels(N);
+    max_level = 0;
+    enter_point = 0;
+    for (int i = 0; i < N; ++i)
+    {
+        levels[i] = get_random_level(ML);
+        if (levels[i] > max_level)
+        {
+            max_level = levels[i];
+            enter_point = i;
+        }
+    }
+    for (int i = 0; i < N; ++i)
+    {
+        nodes[i].neighbors.resize(levels[i] + 1);
+        nodes[i].neighbor_dists.resize(levels[i] + 1);
+    }
+
+    vector<int> order;
+    order.reserve(N);
+    for (int i = 0; i < N; ++i)
+    {
+        if (i != enter_point)
+            order.push_back(i);
+    }
+    stable_sort(order.begin(), order.end(), [&](int a, int b) { return levels[a] > levels[b]; });
+
+    Executor &exec = executor();
+    const int max_wave = max(HNSW_WAVE_MIN_CAP, (int)(N * HNSW_WAVE_MAX_FRACTION));
+    vector<int> slot(N, -1);        // 目标点 -> 桶编号 (每层提交后复位)
+    vector<int> bucket_targets;     // 桶编号 -> 目标点
+    vector<int> bucket_offsets;
+    vector<WaveEdge> edges, sorted_edges;
+
+    int inserted = 1;
+    for (size_t pos = 0; pos < order.size();)
+    {
+        const int wave = (int)min(order.size() - pos, (size_t)min(max_wave, inserted));
+        const int *wave_ids = &order[pos];
+        int wave_top = 0;
+        for (int k = 0; k < wave; ++k)
+            wave_top = max(wave_top, levels[wave_ids[k]]);
+
+        // a) 并行搜索 (快照只读)
+        exec.parallel_for(0, wave, 1, [&](int k, int)
+        {
+            const int i = wave_ids[k];
+            const int level = levels[i];
+            vector<float> query_buf(dimension);
+            const float *query = get_vector(i, query_buf.data());
+
+            vector<int> eps = {greedy_descend(query, enter_point, max_level, level)};
+            vector<pair<float, int>> sorted_cand, selected;
+            for (int lc = min(level, max_level); lc >= 0; --lc)
+            {
+                search_layer_build(query, sorted_cand, eps, EF_CONSTRUCTION, lc);
+                get_neighbors_heuristic(selected, sorted_cand, lc == 0 ? M_max0 : M_max);
+
+                vector<int> &own_neighbors = nodes[i].neighbors[lc];
+                vector<float> &own_dists = nodes[i].neighbor_dists[lc];
+                own_neighbors.clear();
+                own_dists.clear();
+                for (const auto &sel : selected)
+                {
+                    own_dists.push_back(sel.first);
+                    own_neighbors.push_back(sel.second);
+                }
+                eps = own_neighbors;
+            }
+        });
+
+        // b) 批量提交反向边 (逐层)
+        for (int lc = 0; lc <= wave_top; ++lc)
+        {
+            edges.clear();
+            for (int k = 0; k < wave; ++k)
+            {
+                const int i = wave_ids[k];
+                if (levels[i] < lc)
+                    continue;
+                const vector<int> &nbs = nodes[i].neighbors[lc];
+                const vector<float> &ds = nodes[i].neighbor_dists[lc];
+                for (size_t j = 0; j < nbs.size(); ++j)
+                    edges.push_back({nbs[j], i, ds[j]});
+            }
+            if (edges.empty())
+                continue;
+
+            // 按目标点分桶 (计数排序)
+            bucket_targets.clear();
+            bucket_offsets.assign(1, 0);
+            for (const auto &e : edges)
+            {
+                if (slot[e.target] < 0)
+                {
+                    slot[e.target] = (int)bucket_targets.size();
+                    bucket_targets.push_back(e.target);
+                    bucket_offsets.push_back(0);
+                }
+                bucket_offsets[slot[e.target] + 1]++;
+            }
+            for (size_t b = 1; b < bucket_offsets.size(); ++b)
+                bucket_offsets[b] += bucket_offsets[b - 1];
+            sorted_edges.resize(edges.size());
+            {
+                vector<int> fill_pos(bucket_offsets.begin(), bucket_offsets.end() - 1);
+                for (const auto &e : edges)
+                    sorted_edges[fill_pos[slot[e.target]]++] = e;
+            }
+            for (int t : bucket_targets)
+                slot[t] = -1;
+
+            const int M_limit = lc == 0 ? M_max0 : M_max;
+            exec.parallel_for(0, (int)bucket_targets.size(), 16, [&](int b, int)
+            {
+                const int t = bucket_targets[b];
+                vector<int> &target_neighbors = nodes[t].neighbors[lc];
+                vector<float> &target_dists = nodes[t].neighbor_dists[lc];
+                const int incoming = bucket_offsets[b + 1] - bucket_offsets[b];
+                const WaveEdge *in = &sorted_edges[bucket_offsets[b]];
+
+                if (target_neighbors.size() + incoming <= (size_t)M_limit)
+                {
+                    for (int j = 0; j < incoming; ++j)
+                    {
+                        target_neighbors.push_back(in[j].source);
+                        target_dists.push_back(in[j].dist);
+                    }
+                    return;
+                }
+                // 超出度数上限: 旧邻居与新入边合并后一次 RobustPrune
+                vector<pair<float, int>> t_cand, pruned;
+                for (size_t j = 0; j < target_neighbors.size(); ++j)
+                    t_cand.push_back({target_dists[j], target_neighbors[j]});
+                for (int j = 0; j < incoming; ++j)
+                    t_cand.push_back({in[j].dist, in[j].source});
+                sort(t_cand.begin(), t_cand.end());
+                get_neighbors_heuristic(pruned, t_cand, M_limit);
+                target_neighbors.clear();
+                target_dists.clear();
+                for (const auto &p : pruned)
+                {
+                    target_dists.push_back(p.first);
+                    target_neighbors.push_back(p.second);
+                }
+            });
+        }
+
+        pos += wave;
+        inserted += wave;
+    }
+}
+
+// --- NN-Descent 构建模式 ---
+// 1. 随机初始化 kNN 图，按 "邻居的邻居更可能是邻居" 迭代 local join 直至收敛
+// 2. 对每个点的 kNN 列表做 RobustPrune 得到 Layer 0，并补齐反向边
+// 3. 以 1/ln(M) 的层级因子抽取稀疏上层，仅对上层节点做 HNSW 插入 (lc >= 1)
+
+// kNN 图邻居项 (构建期临时结构)
+struct NndNeighbor
+{
+    float dist;
+    int id;
+    bool is_new; // 尚未参与过 local join
+};
+
+// 有序插入 (调用方持有 pool 所属节点的锁)
+static int nnd_try_insert(vector<NndNeighbor> &pool, int id, float d)
+{
+    if (d >= pool.back().dist)
+        return 0;
+    for (const auto &nb : pool)
+    {
+        if (nb.id == id)
+            return 0;
+    }
+    int pos = (int)pool.size() - 1;
+    while (pos > 0 && pool[pos - 1].dist > d)
+    {
+        pool[pos] = pool[pos - 1];
+        pos--;
+    }
+    pool[pos] = {d, id, true};
+    return 1;
+}
+
+void Solution::build_nn_descent(vector<std::mutex> &node_locks)
+{
+    const int N = num_vectors;
+    const int K = min(NND_K, N - 1);
+
+    if (K > 0)
+    {
+        vector<vector<NndNeighbor>> pool(N);
+        // 各列表当前最差距离 (持锁写入)，供 local join 无锁快速拒绝
+        vector<std::atomic<float>> pool_worst(N);
+
+        // 1. 随机初始化
+        executor().parallel_for(0, N, 1024, [&](int i, int)
+        {
+            std::minstd_rand rng(12345 + i);
+            vector<NndNeighbor> &p = pool[i];
+            p.reserve(K);
+            while ((int)p.size() < K)
+            {
+                int c = (int)(rng() % N);
+                if (c == i)
+                    continue;
+                bool dup = false;
+                for (const auto &nb : p)
+                {
+                    if (nb.id == c)
+                    {
+                        dup = true;
+                        break;
+                    }
+                }
+                if (dup)
+                    continue;
+                p.push_back({dist_nodes(i, c), c, true});
+            }
+            sort(p.begin(), p.end(), [](const NndNeighbor &a, const NndNeighbor &b)
+                 { return a.dist < b.dist; });
+            pool_worst[i].store(p.back().dist, std::memory_order_relaxed);
+        });
+
+        // 2. 迭代 local join
+        vector<vector<int>> fwd_new(N), fwd_old(N), rev_new(N), rev_old(N);
+        const long long stop_updates = (long long)(NND_DELTA * N * K);
+
+        for (int iter = 0; iter < NND_MAX_ITERS; ++iter)
+        {
+            // 2.1 采样: 新邻居最多 NND_SAMPLE 个 (采样后标记为旧)
+            executor().parallel_for(0, N, 1024, [&](int i, int)
+            {
+                fwd_new[i].clear();
+                fwd_old[i].clear();
+                rev_new[i].clear();
+                rev_old[i].clear();
+                for (auto &nb : pool[i])
+                {
+                    if (nb.is_new)
+                    {
+                        if ((int)fwd_new[i].size() < NND_SAMPLE)
+                        {
+                            fwd_new[i].push_back(nb.id);
+                            nb.is_new = false;
+                        }
+                    }
+                    else if ((int)fwd_old[i].size() < NND_SAMPLE)
+                    {
+                        fwd_old[i].push_back(nb.id);
+                    }
+                }
+            });
+
+            // 2.2 反向列表
+            executor().parallel_for(0, N, 1024, [&](int i, int)
+            {
+                for (int u : fwd_new[i])
+                {
+                    std::lock_guard<std::mutex> lock(node_locks[u]);
+                    rev_new[u].push_back(i);
+                }
+                for (int u : fwd_old[i])
+                {
+                    std::lock_guard<std::mutex> lock(node_locks[u]);
+                    rev_old[u].push_back(i);
+                }
+            });
+
+            // 2.3 local join: new x new, new x old
+            // 更新计数按执行线程分别累加
+            vector<long long> worker_updates(max(1, executor().concurrency()), 0);
+            executor().parallel_for(0, N, 256, [&](int i, int w)
+            {
+                std::minstd_rand rng(12345 + i + iter * N);
+                vector<int> &nw = fwd_new[i];
+                vector<int> &od = fwd_old[i];
+
+                // 反向列表截断到 NND_SAMPLE (热点节点的反向列表可能很长)
+                vector<int> &rn = rev_new[i];
+                vector<int> &ro = rev_old[i];
+                if ((int)rn.size() > NND_SAMPLE)
+                {
+                    shuffle(rn.begin(), rn.end(), rng);
+                    rn.resize(NND_SAMPLE);
+                }
+                if ((int)ro.size() > NND_SAMPLE)
+                {
+                    shuffle(ro.begin(), ro.end(), rng);
+                    ro.resize(NND_SAMPLE);
+                }
+                vector<int> new_list(nw);
+                new_list.insert(new_list.end(), rn.begin(), rn.end());
+                sort(new_list.begin(), new_list.end());
+                new_list.erase(unique(new_list.begin(), new_list.end()), new_list.end());
+                vector<int> old_list(od);
+                old_list.insert(old_list.end(), ro.begin(), ro.end());
+                sort(old_list.begin(), old_list.end());
+                old_list.erase(unique(old_list.begin(), old_list.end()), old_list.end());
+
+                auto update = [&](int a, int b, float d)
+                {
+                    // 无锁快速拒绝 (允许读到旧值，锁内 nnd_try_insert 会再判断)
+                    if (d >= pool_worst[a].load(std::memory_order_relaxed))
+                        return;
+                    std::lock_guard<std::mutex> lock(node_locks[a]);
+                    if (nnd_try_insert(pool[a], b, d))
+                    {
+                        worker_updates[w]++;
+                        pool_worst[a].store(pool[a].back().dist, std::memory_order_relaxed);
+                    }
+                };
+
+                vector<float> u_buf(dimension);
+                for (size_t a = 0; a < new_list.size(); ++a)
+                {
+                    int u = new_list[a];
+                    const float *vec_u = get_vector(u, u_buf.data());
+                    for (size_t b = a + 1; b < new_list.size(); ++b)
+                    {
+                        int v = new_list[b];
+                        float d = dist_query(vec_u, v);
+                        update(u, v, d);
+                        update(v, u, d);
+                    }
+                    for (int v : old_list)
+                    {
+                        if (u == v)
+                            continue;
+                        float d = dist_query(vec_u, v);
+                        update(u, v, d);
+                        update(v, u, d);
+                    }
+                }
+            });
+
+            long long updates = 0;
+            for (long long u : worker_updates)
+                updates += u;
+            if (updates <= stop_updates)
+                break;
+        }
+
+        vector<vector<int>>().swap(fwd_new);
+        vector<vector<int>>().swap(fwd_old);
+        vector<vector<int>>().swap(rev_new);
+        vector<vector<int>>().swap(rev_old);
+
+        // 3. Layer 0: 对 kNN 列表做 RobustPrune
+        vector<vector<pair<float, int>>> selected(N);
+        executor().parallel_for(0, N, 256, [&](int i, int)
+        {
+            vector<pair<float, int>> sorted_cand;
+            sorted_cand.reserve(pool[i].size());
+            for (const auto &nb : pool[i])
+                sorted_cand.push_back({nb.dist, nb.id});
+            get_neighbors_heuristic(selected[i], sorted_cand, M_max0);
+            vector<NndNeighbor>().swap(pool[i]);
+        });
+
+        for (int i = 0; i < N; ++i)
+        {
+            nodes[i].neighbors.resize(1);
+            nodes[i].neighbor_dists.resize(1);
+            for (const auto &sel : selected[i])
+            {
+                nodes[i].neighbor_dists[0].push_back(sel.first);
+                nodes[i].neighbors[0].push_back(sel.second);
+            }
+        }
+
+        // 补齐反向边
+        executor().parallel_for(0, N, 256, [&](int i, int)
+        {
+            connect_reverse(i, selected[i], 0, M_max0, node_locks, true);
+        });
+    }
+    else
+    {
+        for (int i = 0; i < N; ++i)
+        {
+            nodes[i].neighbors.resize(1);
+            nodes[i].neighbor_dists.resize(1);
+        }
+    }
+
+    // 4. 稀疏上层
+    build_sparse_upper_layers(node_locks);
+}
+
+// 在已有 Layer 0 上抽取稀疏上层: 以 1/ln(M) 的层级因子抽层，仅对上层节点做 HNSW 插入 (lc >= 1)
+void Solution::build_sparse_upper_layers(vector<std::mutex> &node_locks)
+{
+    const int N = num_vectors;
+    vector<int> levels(N);
+    max_level = 0;
+    enter_point = 0;
+    for (int i = 0; i < N; ++i)
+    {
+        levels[i] = get_random_level(ML_SPARSE);
+        if (levels[i] > max_level)
+        {
+            max_level = levels[i];
+            enter_point = i;
+        }
+    }
+    nodes[enter_point].neighbors.resize(max_level + 1);
+    nodes[enter_point].neighbor_dists.resize(max_level + 1);
+
+    // 访问缓存由 search_layer_build 按线程准备
+    executor().parallel_for(0, N, 16, [&](int i, int)
+    {
+        if (levels[i] >= 1 && i != enter_point)
+            insert_point(i, levels[i], 1, node_locks);
+    });
+}
+
+// --- 分治构建: k-means 重叠分区 -> 分区独立建图 -> 合并 Layer 0 ---
+// 1. 采样训练 k 个质心，k 使每个分区约为 partition_size * PARTITION_FILL
+// 2. 每个点按质心距离依次尝试最近的几个分区，放入前 overlap 个未满 (< partition_size) 的分区
+// 3. 逐个分区用默认配置的子 Solution 建图 (HNSW 插入，经本实例的执行器使用全部线程)，
+//    只建到邻接表为止；任一时刻只有一个分区在内存中，额外峰值内存以 partition_size 为界。
+// 4. 分区 Layer 0 映射回全局 id，与该点在其他分区得到的邻居合并后 RobustPrune 到 M_max0
+// 5. 对合并结果补齐反向边 6. 在合并后的 Layer 0 上重建稀疏上层
+void Solution::build_partitioned(vector<std::mutex> &node_locks)
+{
+    const int N = num_vectors;
+    const int cap = max(PARTITION_MIN_SIZE, partition_size_cfg);
+    const int k = (int)ceil((double)N * max(1, partition_overlap) / (cap * PARTITION_FILL));
+    if (N <= cap || k < 2)
+    {
+        build_hnsw_insert(node_locks);
+        return;
+    }
+    const int overlap = min(max(1, partition_overlap), k);
+
+    // 1. k-means 质心
+    int sample_size = min(N, k * PARTITION_KMEANS_SAMPLE);
+    std::mt19937 rng(PARTITION_SEED);
+    vector<float> sample((size_t)sample_size * dimension);
+    for (int i = 0; i < sample_size; ++i)
+    {
+        std::uniform_int_distribution<int> pick(0, N - 1);
+        float *dst = &sample[(size_t)i * dimension];
+        const float *v = get_vector(sample_size == N ? i : pick(rng), dst);
+        if (v != dst)
+            memcpy(dst, v, dimension * sizeof(float));
+    }
+    vector<float> centroids;
+    train_kmeans(sample.data(), sample_size, dimension, k, PARTITION_KMEANS_ITERS, PARTITION_SEED, centroids,
+                 &executor());
+    vector<float>().swap(sample);
+
+    // 2. 容量受限的重叠分配 (每个点记录最近的 choices 个质心，按顺序放入未满分区)
+    const int choices = min(k, overlap + PARTITION_SPARE_CHOICES);
+    vector<int> nearest((size_t)N * choices);
+    executor().parallel_for(0, N, 256, [&](int i, int)
+    {
+        tls_decode_buf.resize(dimension);
+        const float *v = get_vector(i, tls_decode_buf.data());
+        vector<pair<float, int>> order(k);
+        for (int c = 0; c < k; ++c)
+            order[c] = {dist_l2_float_avx(v, &centroids[(size_t)c * dimension], dimension), c};
+        partial_sort(order.begin(), order.begin() + choices, order.end());
+        for (int j = 0; j < choices; ++j)
+            nearest[(size_t)i * choices + j] = order[j].second;
+    });
+
+    vector<vector<int>> members(k);
+    for (int i = 0; i < N; ++i)
+    {
+        int placed = 0;
+        const int *cand = &nearest[(size_t)i * choices];
+        for (int j = 0; j < choices && placed < overlap; ++j)
+        {
+            if ((int)members[cand[j]].size() < cap)
+            {
+                members[cand[j]].push_back(i);
+                placed++;
+            }
+        }
+        // 候选分区都已满: 放入当前最小的分区
+        while (placed < overlap)
+        {
+            int smallest = -1;
+            for (int c = 0; c < k; ++c)
+            {
+                if (!members[c].empty() && members[c].back() == i)
+                    continue; // 已在该分区
+                if (smallest < 0 || members[c].size() < members[smallest].size())
+                    smallest = c;
+            }
+            members[smallest].push_back(i);
+            placed++;
+        }
+    }
+    vector<int>().swap(nearest);
+
+    for (int i = 0; i < N; ++i)
+    {
+        nodes[i].neighbors.resize(1);
+        nodes[i].neighbor_dists.resize(1);
+    }
+
+    // 3 + 4. 分区建图并合并
+    auto build_partition = [&](int p)
+    {
+        const vector<int> &ids = members[p];
+        if (ids.size() < 2)
+            return;
+        const int n = (int)ids.size();
+        huge_vector<float> part_base((size_t)n * dimension);
+        executor().parallel_for(0, n, 1024, [&](int j, int)
+        {
+            float *dst = &part_base[(size_t)j * dimension];
+            const float *v = get_vector(ids[j], dst);
+            if (v != dst)
+                memcpy(dst, v, dimension * sizeof(float));
+        });
+        Solution sub;
+        sub.custom_executor = custom_executor;
+        sub.build_graph_only(dimension, std::move(part_base));
+
+        executor().parallel_for(0, n, 256, [&](int j, int)
+        {
+            vector<pair<float, int>> cand, pruned;
+            const int g = ids[j];
+            const vector<int> &sub_nbs = sub.nodes[j].neighbors[0];
+            const int *nbs = sub_nbs.data();
+            const int count = (int)sub_nbs.size();
+            for (int t = 0; t < count; ++t)
+            {
+                int gn = ids[nbs[t]];
+                cand.push_back({dist_nodes(g, gn), gn});
+            }
+
+            std::lock_guard<std::mutex> lock(node_locks[g]);
+            vector<int> &own = nodes[g].neighbors[0];
+            vector<float> &own_dists = nodes[g].neighbor_dists[0];
+            for (size_t t = 0; t < own.size(); ++t)
+                cand.push_back({own_dists[t], own[t]});
+            sort(cand.begin(), cand.end());
+            cand.erase(unique(cand.begin(), cand.end(),
+                              [](const pair<float, int> &a, const pair<float, int> &b) { return a.second == b.second; }),
+                       cand.end());
+            if ((int)cand.size() > M_max0)
+                get_neighbors_heuristic(pruned, cand, M_max0);
+            else
+                pruned = cand;
+            own.clear();
+            own_dists.clear();
+            for (const auto &c : pruned)
+            {
+                own_dists.push_back(c.first);
+                own.push_back(c.second);
+            }
+        });
+    };
+    Executor &exec = executor();
+    for (int p = 0; p < k; ++p)
+        build_partition(p);
+
+    // 5. 补齐反向边 (基于合并结果的快照，满则 RobustPrune)，连通分区边界
+    vector<vector<pair<float, int>>> forward(N);
+    exec.parallel_for(0, N, 1024, [&](int i, int)
+    {
+        const vector<int> &own = nodes[i].neighbors[0];
+        forward[i].reserve(own.size());
+        for (size_t t = 0; t < own.size(); ++t)
+            forward[i].push_back({nodes[i].neighbor_dists[0][t], own[t]});
+    });
+    exec.parallel_for(0, N, 256, [&](int i, int) { connect_reverse(i, forward[i], 0, M_max0, node_locks, true); });
+    vector<vector<pair<float, int>>>().swap(forward);
+
+    // 6. 稀疏上层
+    build_sparse_upper_layers(node_locks);
+}
+
+void Solution::flatten_layer0()
+{
+    // 旧的压缩记录按字节偏移寻址，与下面重写的 int 偏移不兼容 (重建时必须先释放)
+    huge_vector<uint8_t>().swap(graph_packed);
+
+    // 计算扁平化所需空间
+    size_t total_size = 0;
+    final_graph_offsets.resize(num_vectors);
+
+    for (int i = 0; i < num_vectors; ++i)
+    {
+        final_graph_offsets[i] = total_size;
+        // 格式: [count, n1, n2, ...]
+        if (nodes[i].neighbors.size() > 0)
+        {
+            total_size += 1 + nodes[i].neighbors[0].size();
+        }
+        else
+        {
+            total_size += 1; // count = 0
+        }
+    }
+
+    final_graph_flat.resize(total_size);
+
+    // 填充数据
+    executor().parallel_for(0, num_vectors, 1024, [&](int i, int)
+    {
+        size_t offset = final_graph_offsets[i];
+        if (nodes[i].neighbors.size() > 0)
+        {
+            const vector<int> &nbs = nodes[i].neighbors[0];
+            final_graph_flat[offset] = (int)nbs.size();
+            memcpy(&final_graph_flat[offset + 1], nbs.data(), nbs.size() * sizeof(int));
+
+            // 释放内存：Layer 0 数据已转移，清空原 vector
+            // vector<int>().swap(nodes[i].neighbors[0]);
+            // 注意：不要在这里释放，因为 high layer search 可能偶尔需要用到？
+            // 不，high layer search 只涉及 lc > 0。
+            // 实际上，为了内存，我们可以清空 nodes[i].neighbors[0]
+            // 但 nodes 是 vector<vector<int>>，清空第0个元素只是变为空 vector
+        }
+        else
+        {
+            final_graph_flat[offset] = 0;
+        }
+
+        // 压缩格式要求邻居按 id 升序 (之后的 PQ4 邻居块等与此顺序一致)
+        if (compress_adjacency_cfg)
+            sort(&final_graph_flat[offset + 1], &final_graph_flat[offset + 1] + final_graph_flat[offset]);
+    });
+}
+
+// --- 压缩 Layer 0 邻接表 (差分 + 位打包) ---
+// 每个节点一条字节记录: [count:u8][width:u8][first:u32][(count-1) 个差分，每个 width 位，低位在前]
+// 邻居按 id 升序排列 (flatten_layer0 中排序)，差分为相邻 id 之差；final_graph_offsets 改为字节偏移。
+// 数组尾部留 ADJ_PACK_PADDING 字节，解码时可越过记录末尾做整字读取。
+
+static inline int bits_needed(uint32_t v)
+{
+    return v == 0 ? 0 : 32 - __builtin_clz(v);
+}
+
+void Solution::compress_layer0()
+{
+    // 1. 每个节点的差分位宽与记录长度
+    vector<uint8_t> widths(num_vectors);
+    vector<size_t> record_bytes(num_vectors);
+    executor().parallel_for(0, num_vectors, 1024, [&](int i, int)
+    {
+        const int *nbs = &final_graph_flat[final_graph_offsets[i] + 1];
+        int count = nbs[-1];
+        int width = 0;
+        for (int j = 1; j < count; ++j)
+            width = max(width, bits_needed((uint32_t)(nbs[j] - nbs[j - 1])));
+        widths[i] = (uint8_t)width;
+        record_bytes[i] = ADJ_PACK_HEADER + ((size_t)max(0, count - 1) * width + 7) / 8;
+    });
+
+    // 2. 字节偏移
+
+    huge_vector<size_t> offsets(num_vectors);
+    size_t total = 0;
+    for (int i = 0; i < num_vectors; ++i)
+    {
+        offsets[i] = total;
+        total += record_bytes[i];
+    }
+    graph_packed.assign(total + ADJ_PACK_PADDING, 0);
+
+    // 3. 写记录 (记录之间不重叠，差分按字节或入)
+    executor().parallel_for(0, num_vectors, 1024, [&](int i, int)
+    {
+        const int *nbs = &final_graph_flat[final_graph_offsets[i] + 1];
+        const int count = nbs[-1];
+        const int width = widths[i];
+        uint8_t *rec = &graph_packed[offsets[i]];
+        rec[0] = (uint8_t)count;
+        rec[1] = (uint8_t)width;
+        uint32_t first = count > 0 ? (uint32_t)nbs[0] : 0;
+        memcpy(rec + 2, &first, sizeof(first));
+
+        uint8_t *bits = rec + ADJ_PACK_HEADER;
+        for (int j = 1; j < count; ++j)
+        {
+            size_t bit = (size_t)(j - 1) * width;
+            uint64_t chunk = (uint64_t)(uint32_t)(nbs[j] - nbs[j - 1]) << (bit & 7);
+            for (int k = 0; k * 8 < width + (int)(bit & 7); ++k)
+                bits[(bit >> 3) + k] |= (uint8_t)(chunk >> (8 * k));
+        }
+    });
+
+    final_graph_offsets.swap(offsets);
+    huge_vector<int>().swap(final_graph_flat);
+    for (int i = 0; i < num_vectors; ++i)
+    {
+        if (!nodes[i].neighbors.empty())
+            vector<int>().swap(nodes[i].neighbors[0]);
+    }
+
+    // 邻接预取行数按平均记录长度
+    adj_lines = max(1, (int)((total / max(1, num_vectors) + 63) / 64));
+}
+
+// 解码节点 id 的邻居到 out (容量至少 count 向上取 8 的整数倍)，返回邻居数
+int Solution::decode_layer0(int id, int *out) const
+{
+    const uint8_t *rec = &graph_packed[final_graph_offsets[id]];
+    const int count = rec[0];
+    const int width = rec[1];
+    uint32_t first;
+    memcpy(&first, rec + 2, sizeof(first));
+    if (count == 0)
+        return 0;
+    out[0] = (int)first;
+    const uint8_t *bits = rec + ADJ_PACK_HEADER;
+    const int deltas = count - 1;
+    const uint32_t mask = width >= 32 ? 0xffffffffu : ((1u << width) - 1);
+    int j = 0;
+    int prev = (int)first;
+#if defined(__AVX2__)
+    // 宽度 <= 25 时每个差分落在一个 32 位窗口内: gather 取窗口 -> 变长右移 -> 掩码 -> 8 路前缀和
+    if (width <= 25)
+    {
+        const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        const __m256i vmask = _mm256_set1_epi32((int)mask);
+        const __m256i seven = _mm256_set1_epi32(7);
+        const __m256i high_half = _mm256_setr_epi32(0, 0, 0, 0, -1, -1, -1, -1);
+        __m256i running = _mm256_set1_epi32(prev);
+        for (; j + 8 <= deltas; j += 8)
+        {
+            __m256i bitpos = _mm256_mullo_epi32(_mm256_add_epi32(lane, _mm256_set1_epi32(j)), _mm256_set1_epi32(width));
+            __m256i word = _mm256_i32gather_epi32((const int *)bits, _mm256_srli_epi32(bitpos, 3), 1);
+            __m256i v = _mm256_and_si256(_mm256_srlv_epi32(word, _mm256_and_si256(bitpos, seven)), vmask);
+            // 128 位内前缀和，再把低半部分的总和加到高半部分
+            v = _mm256_add_epi32(v, _mm256_slli_si256(v, 4));
+            v = _mm256_add_epi32(v, _mm256_slli_si256(v, 8));
+            __m256i carry = _mm256_permutevar8x32_epi32(v, _mm256_set1_epi32(3));
+            v = _mm256_add_epi32(v, _mm256_and_si256(carry, high_half));
+            v = _mm256_add_epi32(v, running);
+            _mm256_storeu_si256((__m256i *)(out + 1 + j), v);
+            running = _mm256_permutevar8x32_epi32(v, _mm256_set1_epi32(7));
+        }
+        prev = j > 0 ? out[j] : prev;
+    }
+#endif
+    for (; j < deltas; ++j)
+    {
+        size_t bit = (size_t)j * width;
+        uint64_t word;
+        memcpy(&word, bits + (bit >> 3), sizeof(word));
+        prev += (int)((word >> (bit & 7)) & mask);
+        out[1 + j] = prev;
+    }
+    return count;
+}
+
+size_t Solution::layer0_graph_bytes() const
+{
+    return final_graph_flat.size() * sizeof(int) + graph_packed.size() +
+           final_graph_offsets.size() * sizeof(size_t);
+}
+
+// Layer 0 邻居表: 未压缩时直接指向 final_graph_flat，压缩时解码到 buf (容量 ADJ_DECODE_CAPACITY)
+inline const int *Solution::layer0_neighbors(int id, int *buf, int &count) const
+{
+    if (graph_packed.empty())
+    {
+        size_t offset = final_graph_offsets[id];
+        count = final_graph_flat[offset];
+        return &final_graph_flat[offset + 1];
+    }
+    count = decode_layer0(id, buf);
+    return buf;
+}
+
+// --- 紧凑高层 (Layer >= 1) ---
+// 高层节点重新编号，邻接表按 [count, n1, n2, ...] 连续存放 (邻居为紧凑编号)，
+// 向量单独拷贝一份 (FP32 或 SQ8)，高层下降只访问这几块小数组
+void Solution::build_upper_layers()
+{
+    vector<int>().swap(upper_ids);
+    huge_vector<int>().swap(upper_adj);
+    huge_vector<size_t>().swap(upper_offsets);
+    huge_vector<float>().swap(upper_vectors);
+    huge_vector<unsigned char>().swap(upper_quant);
+    upper_enter = 0;
+
+    if (upper_mode == UPPER_GRAPH || max_level == 0)
+        return;
+
+    // 1. 重编号
+    vector<int> local_id(num_vectors, -1);
+    for (int i = 0; i < num_vectors; ++i)
+    {
+        if ((int)nodes[i].neighbors.size() > 1)
+        {
+            local_id[i] = (int)upper_ids.size();
+            upper_ids.push_back(i);
+        }
+    }
+    const int num_upper = (int)upper_ids.size();
+    upper_enter = local_id[enter_point];
+
+    // 2. 邻接表: upper_offsets[c * max_level + (lc - 1)]，位置 0 为共享的空表
+    upper_offsets.assign((size_t)num_upper * max_level, 0);
+    upper_adj.push_back(0);
+    for (int c = 0; c < num_upper; ++c)
+    {
+        const auto &levels = nodes[upper_ids[c]].neighbors;
+        for (int lc = 1; lc < (int)levels.size(); ++lc)
+        {
+            upper_offsets[(size_t)c * max_level + (lc - 1)] = upper_adj.size();
+            upper_adj.push_back((int)levels[lc].size());
+            for (int n : levels[lc])
+                upper_adj.push_back(local_id[n]);
+        }
+    }
+
+    // 3. 向量副本
+    if (upper_mode == UPPER_COMPACT_SQ8 && use_quantization)
+    {
+        upper_quant.resize((size_t)num_upper * dimension);
+        executor().parallel_for(0, num_upper, 1024, [&](int c, int)
+        {
+            memcpy(&upper_quant[(size_t)c * dimension], &data_quant[(size_t)upper_ids[c] * dimension],
+                   dimension);
+        });
+    }
+    else
+    {
+        upper_vectors.resize((size_t)num_upper * dimension);
+        executor().parallel_for(0, num_upper, 1024, [&](int c, int)
+        {
+            float *dst = &upper_vectors[(size_t)c * dimension];
+            const float *v = get_vector(upper_ids[c], dst);
+            if (v != dst)
+                memcpy(dst, v, dimension * sizeof(float));
+        });
+    }
+}
+
+// 紧凑高层上的贪婪下降，返回 Layer 0 入口 (原编号)
+int Solution::descend_upper_compact(const float *query) const
+{
+    const bool sq8 = !upper_quant.empty();
+    const unsigned char *q_quant = nullptr;
+    if (sq8)
+    {
+        tls_upper_query_quant.resize(dimension);
+        quantize_vec(query, tls_upper_query_quant.data());
+        q_quant = tls_upper_query_quant.data();
+    }
+    auto dist = [&](int c) -> float
+    {
+        return sq8 ? dist_l2_u8(&upper_quant[(size_t)c * dimension], q_quant, dimension)
+                   : dist_l2_float_avx(query, &upper_vectors[(size_t)c * dimension], dimension);
+    };
+
+    int curr = upper_enter;
+    float curr_dist = dist(curr);
+    for (int lc = max_level; lc > 0; --lc)
+    {
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            const int *adj = &upper_adj[upper_offsets[(size_t)curr * max_level + (lc - 1)]];
+            const int count = adj[0];
+            for (int i = 1; i <= count; ++i)
+            {
+                if (i + 1 <= count)
+                {
+                    const char *next = sq8 ? (const char *)&upper_quant[(size_t)adj[i + 1] * dimension]
+                                           : (const char *)&upper_vectors[(size_t)adj[i + 1] * dimension];
+                    _mm_prefetch(next, _MM_HINT_T0);
+                }
+                float d = dist(adj[i]);
+                if (d < curr_dist)
+                {
+                    curr_dist = d;
+                    curr = adj[i];
+                    changed = true;
+                }
+            }
+        }
+    }
+    return upper_ids[curr];
+}
+
+// --- k-means (入口点表 / 分片划分共用) ---
+// 随机取 k 个样本初始化，空簇重新取样；centroids 输出 k x d。分配步骤在 executor 上并行 (空: OpenMP)
+void Solution::train_kmeans(const float *data, int n, int d, int k, int iters, unsigned seed,
+                            vector<float> &centroids, Executor *executor)
+{
+    Executor &exec = executor ? *executor : default_executor();
+    std::mt19937 rng(seed);
+    vector<int> init(n);
+    for (int i = 0; i < n; ++i)
+        init[i] = i;
+    for (int i = 0; i < k; ++i)
+    {
+        std::uniform_int_distribution<int> pick(i, n - 1);
+        swap(init[i], init[pick(rng)]);
+    }
+    centroids.resize((size_t)k * d);
+    for (int c = 0; c < k; ++c)
+        memcpy(&centroids[(size_t)c * d], &data[(size_t)init[c] * d], d * sizeof(float));
+
+    vector<int> assign(n, 0);
+    vector<double> sums((size_t)k * d);
+    vector<int> counts(k);
+    for (int iter = 0; iter < iters; ++iter)
+    {
+        exec.parallel_for(0, n, 1024, [&](int i, int)
+                          { assign[i] = nearest_centroid(&data[(size_t)i * d], centroids.data(), k, d); });
+
+        fill(sums.begin(), sums.end(), 0.0);
+        fill(counts.begin(), counts.end(), 0);
+        for (int i = 0; i < n; ++i)
+        {
+            const float *v = &data[(size_t)i * d];
+            double *s = &sums[(size_t)assign[i] * d];
+            for (int j = 0; j < d; ++j)
+                s[j] += v[j];
+            counts[assign[i]]++;
+        }
+        for (int c = 0; c < k; ++c)
+        {
+            float *dst = &centroids[(size_t)c * d];
+            if (counts[c] == 0)
+            {
+                std::uniform_int_distribution<int> pick(0, n - 1);
+                memcpy(dst, &data[(size_t)pick(rng) * d], d * sizeof(float));
+                continue;
+            }
+            const double *s = &sums[(size_t)c * d];
+            for (int j = 0; j < d; ++j)
+                dst[j] = (float)(s[j] / counts[c]);
+        }
+    }
+}
+
+int Solution::nearest_centroid(const float *v, const float *centroids, int k, int d)
+{
+    int best_c = 0;
+    float best = std::numeric_limits<float>::max();
+    for (int c = 0; c < k; ++c)
+    {
+        float dist = dist_l2_float_avx(v, &centroids[(size_t)c * d], d);
+        if (dist < best)
+        {
+            best = dist;
+            best_c = c;
+        }
+    }
+    return best_c;
+}
+
+// --- 入口点表 (多种子 / 质心入口) ---
+// build 末尾对采样基向量做 k-means，每个质心经图搜索映射到最近的节点；
+// 查询时 SIMD 扫描质心表，取最近的 entry_seeds 个节点作为 Layer 0 入口
+void Solution::build_entry_table()
+{
+    huge_vector<float>().swap(entry_centroids);
+    vector<int>().swap(entry_nodes);
+
+    int k = min(entry_centroids_cfg, num_vectors);
+    if (k <= 0)
+        return;
+
+    // 1. 采样 (连续 FP32 拷贝，半精度模式下解码)
+    int sample_size = min(num_vectors, k * ENTRY_SAMPLE_PER_CENTROID);
+    vector<int> sample_ids(num_vectors);
+    for (int i = 0; i < num_vectors; ++i)
+        sample_ids[i] = i;
+    std::mt19937 rng(ENTRY_SEED);
+    for (int i = 0; i < sample_size; ++i)
+    {
+        std::uniform_int_distribution<int> pick(i, num_vectors - 1);
+        swap(sample_ids[i], sample_ids[pick(rng)]);
+    }
+    sample_ids.resize(sample_size);
+
+    vector<float> sample((size_t)sample_size * dimension);
+    executor().parallel_for(0, sample_size, 64, [&](int i, int)
+    {
+        float *dst = &sample[(size_t)i * dimension];
+        const float *v = get_vector(sample_ids[i], dst);
+        if (v != dst)
+            memcpy(dst, v, dimension * sizeof(float));
+    });
+
+    // 2. k-means
+    vector<float> centroids;
+    train_kmeans(sample.data(), sample_size, dimension, k, ENTRY_KMEANS_ITERS, ENTRY_SEED, centroids, &executor());
+    entry_centroids.assign(centroids.begin(), centroids.end());
+
+    // 3. 质心 -> 最近图节点 (小 ef 图搜索 + 精确距离)
+    entry_nodes.assign(k, enter_point);
+    executor().parallel_for(0, k, 1, [&](int c, int)
+    {
+        const float *centroid = &entry_centroids[(size_t)c * dimension];
+        tls_quant_query_buf.resize(dimension);
+        quantize_vec(centroid, tls_quant_query_buf.data());
+
+        vector<int> ep = {descend_upper_layers(centroid)};
+        vector<int> found;
+        search_layer_query(centroid, tls_quant_query_buf.data(), found, ep, ENTRY_MAP_EF, 0);
+
+        float best = std::numeric_limits<float>::max();
+        for (int id : found)
+        {
+            float d = dist_query(centroid, id);
+            if (d < best)
+            {
+                best = d;
+                entry_nodes[c] = id;
+            }
+        }
+    });
+}
+
+// 查询入口: 未建表时为高层下降的结果；否则为最近的种子 (+ 高层下降结果)
+void Solution::select_entry_points(const float *query, vector<int> &eps) const
+{
+    eps.clear();
+    const int k = (int)entry_nodes.size();
+    if (k == 0 || entry_seeds <= 0)
+    {
+        eps.push_back(descend_upper_layers(query));
+        return;
+    }
+
+    // 线性扫描质心表，插入排序维护最近的 seeds 个
+    const int seeds = min(min(entry_seeds, k), ENTRY_SEEDS_MAX);
+    pair<float, int> best[ENTRY_SEEDS_MAX];
+    int best_size = 0;
+    for (int c = 0; c < k; ++c)
+    {
+        float d = dist_l2_float_avx(query, &entry_centroids[(size_t)c * dimension], dimension);
+        if (best_size < seeds || d < best[best_size - 1].first)
+        {
+            int pos = (best_size < seeds) ? best_size++ : best_size - 1;
+            while (pos > 0 && best[pos - 1].first > d)
+            {
+                best[pos] = best[pos - 1];
+                pos--;
+            }
+            best[pos] = {d, c};
+        }
+    }
+
+    if (!entry_skip_upper)
+        eps.push_back(descend_upper_layers(query));
+    for (int i = 0; i < best_size; ++i)
+    {
+        int id = entry_nodes[best[i].second];
+        if (find(eps.begin(), eps.end(), id) == eps.end())
+            eps.push_back(id);
+    }
+}
+
+// --- 查询结果缓存 ---
+// 以 SQ8 编码后的查询 (及 ef / patience) 为键: 完全重复与量化后相同的近重复查询都会命中。
+// 定长槽位 + CLOCK 淘汰，一把锁保护；命中时比较完整编码，哈希碰撞不会返回错误结果。
+struct Solution::ResultCache
+{
+    struct Slot
+    {
+        uint64_t key = 0;
+        vector<unsigned char> code;
+        int res[10];
+        float dists[10]; // SSD 模式的精确距离 (其余模式不使用)
+        bool used = false;
+        bool referenced = false;
+    };
+
+    std::mutex mutex;
+    vector<Slot> slots;
+    unordered_map<uint64_t, int> index; // key -> slot (同键只保留一个槽位)
+    size_t hand = 0;
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+
+    explicit ResultCache(size_t capacity) : slots(capacity) { index.reserve(capacity); }
+
+    static uint64_t hash(const vector<unsigned char> &code)
+    {
+        // FNV-1a
+        uint64_t h = 1469598103934665603ULL;
+        for (unsigned char c : code)
+        {
+            h ^= c;
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+    bool lookup(uint64_t key, const vector<unsigned char> &code, int *res, float *dists = nullptr)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(key);
+        if (it == index.end() || slots[it->second].code != code)
+        {
+            misses.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        Slot &slot = slots[it->second];
+        slot.referenced = true;
+        memcpy(res, slot.res, sizeof(slot.res));
+        if (dists)
+            memcpy(dists, slot.dists, sizeof(slot.dists));
+        hits.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    void insert(uint64_t key, const vector<unsigned char> &code, const int *res, const float *dists = nullptr)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        int target;
+        auto it = index.find(key);
+        if (it != index.end())
+        {
+            target = it->second; // 碰撞或并发重复插入: 覆盖
+        }
+        else
+        {
+            // CLOCK: 跳过最近被引用的槽位 (清除其引用位)
+            while (slots[hand].used && slots[hand].referenced)
+            {
+                slots[hand].referenced = false;
+                hand = (hand + 1) % slots.size();
+            }
+            target = (int)hand;
+            hand = (hand + 1) % slots.size();
+            if (slots[target].used)
+                index.erase(slots[target].key);
+            index[key] = target;
+        }
+        Slot &slot = slots[target];
+        slot.key = key;
+        slot.code = code;
+        memcpy(slot.res, res, sizeof(slot.res));
+        if (dists)
+            memcpy(slot.dists, dists, sizeof(slot.dists));
+        slot.used = true;
+        slot.referenced = false;
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (Slot &slot : slots)
+        {
+            slot.used = false;
+            slot.referenced = false;
+            vector<unsigned char>().swap(slot.code);
+        }
+        index.clear();
+        hand = 0;
+    }
+};
+
+void Solution::set_result_cache(size_t capacity)
+{
+    result_cache = capacity > 0 ? make_shared<ResultCache>(capacity) : nullptr;
+}
+
+void Solution::clear_result_cache()
+{
+    if (result_cache)
+        result_cache->clear();
+}
+
+Solution::ResultCacheStats Solution::result_cache_stats() const
+{
+    ResultCacheStats stats = {0, 0, 0};
+    if (!result_cache)
+        return stats;
+    stats.hits = result_cache->hits.load(std::memory_order_relaxed);
+    stats.misses = result_cache->misses.load(std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(result_cache->mutex);
+    stats.entries = result_cache->index.size();
+    return stats;
+}
+
+// 缓存键: 查询编码 (SQ8，量化不可用时为原始字节) + 影响结果的查询参数
+static void make_cache_code(const float *query, const unsigned char *query_quant, bool quantized, int d,
+                            int ef, int patience, vector<unsigned char> &code)
+{
+    if (quantized)
+        code.assign(query_quant, query_quant + d);
+    else
+        code.assign((const unsigned char *)query, (const unsigned char *)(query + d));
+    const unsigned char *p = (const unsigned char *)&ef;
+    code.insert(code.end(), p, p + sizeof(ef));
+    p = (const unsigned char *)&patience;
+    code.insert(code.end(), p, p + sizeof(patience));
+}
+
+// --- 搜索接口 ---
+void Solution::search(const vector<float> &query, int *res)
+{
+    search_query(query.data(), res, nullptr);
+}
+
+void Solution::search_with_distances(const vector<float> &query, int *res, float *dists)
+{
+    search_query(query.data(), res, dists);
+}
+
+// search / search_with_distances 共用的单查询流程。dists 非空时输出精确 L2 平方距离:
+// SSD 模式取 beam search 展开时的精确距离 (随结果一并缓存)，否则由全精度向量重算
+void Solution::search_query(const float *query, int *res, float *dists)
+{
+    if (num_vectors == 0)
+        return;
+
+    // 0. 投影 (遍历在投影空间进行，重排使用原查询)
+    const float *tq = traversal_query(query);
+    // 全维索引空间中的查询 (重排/精确搜索): 投影模式为原查询，否则与遍历查询相同
+    const float *rq = data_full.empty() ? tq : query;
+
+    // 1. 量化查询向量 (用于Layer 0)
+    tls_quant_query_buf.resize(dimension);
+    unsigned char *q_quant_ptr = tls_quant_query_buf.data();
+    quantize_vec(tq, q_quant_ptr);
+
+    float disk_dists[TOP_K];
+    auto output_dists = [&]()
+    {
+        if (!dists)
+            return;
+        for (int i = 0; i < TOP_K; ++i)
+            dists[i] = disk ? disk_dists[i] : dist_full(rq, res[i]);
+    };
+
+    // 结果缓存
+    uint64_t cache_key = 0;
+    if (result_cache)
+    {
+        make_cache_code(tq, q_quant_ptr, use_quantization, dimension, query_ef(),
+                        adaptive_patience, tls_cache_code);
+        cache_key = ResultCache::hash(tls_cache_code);
+        if (result_cache->lookup(cache_key, tls_cache_code, res, disk_dists))
+        {
+            output_dists();
+            return;
+        }
+    }
+
+    if (disk)
+    {
+        // SSD 常驻模式: beam search + 批量读盘 (读盘失败的结果不进缓存)
+        if (!search_disk(rq, q_quant_ptr, res, disk_dists))
+        {
+            output_dists();
+            return;
+        }
+    }
+    else if (num_vectors <= EXACT_FALLBACK_MAX)
+    {
+        // 小索引: 精确搜索比图遍历更快且召回为 1
+        exact_search(&rq, 1, TOP_K, res, nullptr, nullptr);
+    }
+    else
+    {
+        // 2. 高层导航 (Layer max ~ 1) / 入口点表
+        vector<int> ep_container;
+        select_entry_points(tq, ep_container);
+
+        // 3. 底层搜索 (Layer 0) - 使用量化距离 (SQ + Flattened Graph)
+        vector<int> candidates;
+        search_layer_query(tq, q_quant_ptr, candidates, ep_container, query_ef(), 0);
+
+        // 二值码遍历: 先用 SQ8 距离缩小候选，再做 FP32 重排
+        narrow_binary_candidates(q_quant_ptr, candidates);
+
+        // 4. 重排并填充结果
+        rerank_topk(rq, candidates, res);
+    }
+
+    if (result_cache)
+        result_cache->insert(cache_key, tls_cache_code, res, disk ? disk_dists : nullptr);
+    output_dists();
+}
+
+// 拷贝得到的实例不共享缓存与单查询并行状态 (分片各自持有)
+void Solution::detach_shared_state()
+{
+    if (result_cache)
+        result_cache = make_shared<ResultCache>(result_cache->slots.size());
+    intra_state.reset();
+}
+
+int Solution::query_ef() const
+{
+    return (custom_ef_search > 0) ? min(custom_ef_search, EF_SEARCH_MAX) : EF_SEARCH;
+}
+
+// 高层导航 (Layer max ~ 1) - 使用精确距离 (Float + AVX)，返回 Layer 0 入口
+int Solution::descend_upper_layers(const float *query) const
+{
+    if (!upper_ids.empty())
+        return descend_upper_compact(query);
+
+    int curr_ep = enter_point;
+
+    // 优化方案D建议：高层ef可设为1或稍大。为了召回率，保持 ef=1 足够，
+    // 但如果在 layer 1 附近，可以稍微增大搜索范围。
+    // 基准代码通常 ef=1。
+
+    for (int lc = max_level; lc > 0; --lc)
+    {
+        // 在高层我们不做复杂的搜索，只做贪婪下降
+        // 但复用 search_layer_query 也可以，只要 ef=1
+        // 为了极致速度，手写简单贪婪遍历
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            float dist = dist_query(query, curr_ep);
+            const vector<int> &nbs = nodes[curr_ep].neighbors[lc];
+
+            for (int n : nbs)
+            {
+                float d = dist_query(query, n);
+                if (d < dist)
+                {
+                    dist = d;
+                    curr_ep = n;
+                    changed = true;
+                }
+            }
+        }
+    }
+    return curr_ep;
+}
+
+// 二值码遍历的两级重排第一级: 按 SQ8 距离保留 max(BINARY_SQ8_KEEP_MIN, 1/4) 个候选 (未启用二值码时不变)
+void Solution::narrow_binary_candidates(const unsigned char *query_quant, vector<int> &candidates) const
+{
+    if (data_binary.empty() || !use_quantization)
+        return;
+    size_t keep = max((size_t)BINARY_SQ8_KEEP_MIN, candidates.size() / 4);
+    if (candidates.size() <= keep)
+        return;
+    tls_sq8_rerank.clear();
+    for (int id : candidates)
+        tls_sq8_rerank.push_back({dist_l2_quant(id, query_quant, dimension), id});
+    nth_element(tls_sq8_rerank.begin(), tls_sq8_rerank.begin() + keep, tls_sq8_rerank.end());
+    candidates.resize(keep);
+    for (size_t i = 0; i < keep; ++i)
+        candidates[i] = tls_sq8_rerank[i].second;
+}
+
+// ---------------------------------------------------------
+// 【关键修复】重排序 (Re-ranking) - 使用精确浮点距离
+// ---------------------------------------------------------
+// Layer 0 搜索使用量化距离，快但有误差
+// 必须用精确距离重新排序，才能保证召回率
+void Solution::rerank_topk(const float *query, const vector<int> &candidates, int *res) const
+{
+    tls_candidate_queue.clear();
+
+    // 全维精确距离: 投影模式用 data_full；半精度模式下若保留了 FP32 副本，则用其做精确重排
+    for (int cand_id : candidates)
+    {
+        // 使用 AVX 精确浮点距离重新计算
+        float exact_dist = dist_full(query, cand_id);
+        tls_candidate_queue.push_back({exact_dist, cand_id});
+    }
+
+    // 排序：按距离从小到大
+    // 只需要 Top 10，使用 partial_sort 比 sort 更快
+    if (tls_candidate_queue.size() > 10)
+    {
+        std::partial_sort(tls_candidate_queue.begin(),
+                          tls_candidate_queue.begin() + 10,
+                          tls_candidate_queue.end());
+    }
+    else
+    {
+        std::sort(tls_candidate_queue.begin(), tls_candidate_queue.end());
+    }
+
+    // 填充结果
+    for (int i = 0; i < 10 && i < (int)tls_candidate_queue.size(); ++i)
+    {
+        res[i] = tls_candidate_queue[i].second;
+    }
+    // 补位
+    for (int i = tls_candidate_queue.size(); i < 10; ++i)
+    {
+        res[i] = tls_candidate_queue.empty() ? 0 : tls_candidate_queue[0].second;
+    }
+}
+
+// --- 交错多查询遍历 (软件流水线) ---
+// 单线程同时推进一组查询的 Layer 0 搜索，每个查询是一个状态机:
+//   一轮 = 计算上一轮已预取的邻居距离 -> 弹出下一个候选并预取其未访问邻居 -> 预取新堆顶的邻接记录
+// 随后切换到下一个查询，使预取在其他查询计算期间完成，隐藏 DRAM 延迟。
+struct InterleavedQuery
+{
+    const float *query;      // 遍历用 (投影模式下为投影后的查询)
+    const float *raw;        // 原查询 (重排用)
+    vector<float> projected; // 投影缓冲
+    int *res;
+    VisitedBuffer *visited;
+    vector<Candidate> W; // 结果集 (升序)
+    int W_size;
+    vector<pair<float, int>> heap; // 候选最小堆
+    const int *pending;            // 已预取、待计算的邻居
+    vector<int> adj_buf;           // 压缩邻接表的解码缓冲
+    vector<unsigned char> quant;   // SQ8 查询 (二值码遍历后的第一级重排)
+    vector<uint64_t> bits;         // 二值码遍历: 查询的二值码
+    vector<uint8_t> pq4_lut;       // fast-scan: 距离表与当前展开节点的邻居估计距离
+    vector<uint16_t> pq4_scores;
+    float pq4_bias, pq4_scale, pq4_bound;
+    int pending_count;
+    int stable_expansions;
+    bool done;
+    bool cached;                      // 结果缓存命中 (不遍历、不重排)
+    uint64_t cache_key;
+    vector<unsigned char> cache_code;
+};
+
+static thread_local vector<VisitedBuffer> tls_group_visited;
+
+void Solution::search_group(const vector<vector<float>> &queries, int begin, int end, int *res)
+{
+    if (num_vectors == 0 || begin >= end)
+        return;
+
+    const int count = end - begin;
+    const int ef = query_ef();
+    if ((int)tls_group_visited.size() < count)
+        tls_group_visited.resize(count);
+
+    vector<InterleavedQuery> states(count);
+    vector<int> entry_buf;
+
+    // Layer 0 遍历距离与 fast-scan 过滤 (与 search_layer_query 一致)
+    const bool binary = !data_binary.empty();
+    const bool fastscan = !binary && !pq4_blocks.empty();
+    auto traversal_dist = [&](const InterleavedQuery &st, int id) -> float
+    {
+        if (binary)
+            return (float)hamming_distance(st.bits.data(), &data_binary[(size_t)id * binary_words], binary_words);
+        return st.W_size == ef ? dist_query_bounded(st.query, id, st.W[st.W_size - 1].dist)
+                               : dist_query(st.query, id);
+    };
+    auto prefetch_code = [&](int id)
+    {
+        if (binary)
+            _mm_prefetch((const char *)&data_binary[(size_t)id * binary_words], _MM_HINT_T0);
+        else
+            prefetch_vector(id);
+    };
+
+    // 弹出下一个候选并预取其邻居; 返回 false 表示该查询结束
+    auto advance = [&](InterleavedQuery &st) -> bool
+    {
+        while (!st.heap.empty())
+        {
+            pop_heap(st.heap.begin(), st.heap.end(), greater<pair<float, int>>());
+            pair<float, int> curr = st.heap.back();
+            st.heap.pop_back();
+
+            if (st.W_size == ef && curr.first > st.W[st.W_size - 1].dist)
+                return false;
+
+            st.pending = layer0_neighbors(curr.second, st.adj_buf.data(), st.pending_count);
+            st.pq4_bound = std::numeric_limits<float>::max();
+            if (fastscan && st.W_size == ef)
+            {
+                pq4_scan_neighbors(curr.second, st.pending_count, st.pq4_lut.data(), st.pq4_scores.data());
+                st.pq4_bound = st.W[st.W_size - 1].dist * PQ4_SLACK;
+            }
+            for (int i = 0; i < st.pending_count; ++i)
+            {
+                if (!st.visited->is_visited(st.pending[i]))
+                    prefetch_code(st.pending[i]);
+            }
+            if (!st.heap.empty())
+                prefetch_adjacency(st.heap.front().second);
+            return true;
+        }
+        return false;
+    };
+
+    // 初始化: 高层同步下降，Layer 0 入口点入堆
+    for (int k = 0; k < count; ++k)
+    {
+        InterleavedQuery &st = states[k];
+        st.raw = queries[begin + k].data();
+        st.query = st.raw;
+        if (!data_full.empty())
+        {
+            st.projected.resize(dimension);
+            project_vector(st.raw, st.projected.data());
+            st.query = st.projected.data();
+        }
+        else if (!dim_order.empty())
+        {
+            st.raw = st.query = index_query(st.raw, st.projected);
+        }
+        st.res = res + (size_t)(begin + k) * 10;
+        st.visited = &tls_group_visited[k];
+        st.visited->prepare(num_vectors);
+        st.W.resize(ef);
+        st.W_size = 0;
+        st.stable_expansions = 0;
+        st.pending = nullptr;
+        st.pending_count = 0;
+        st.adj_buf.resize(ADJ_DECODE_CAPACITY);
+        st.quant.resize(dimension);
+        quantize_vec(st.query, st.quant.data());
+        // 结果缓存 (键与 search 相同): 命中的查询不参与交错遍历
+        st.cached = false;
+        if (result_cache)
+        {
+            make_cache_code(st.query, st.quant.data(), use_quantization, dimension, ef, adaptive_patience,
+                            st.cache_code);
+            st.cache_key = ResultCache::hash(st.cache_code);
+            if (result_cache->lookup(st.cache_key, st.cache_code, st.res))
+            {
+                st.cached = st.done = true;
+                continue;
+            }
+        }
+        if (binary)
+        {
+            st.bits.resize(binary_words);
+            encode_binary(st.query, st.bits.data());
+        }
+        if (fastscan)
+        {
+            st.pq4_lut.resize((size_t)pq4_subspaces * PQ4_KSUB);
+            build_pq4_lut(st.query, st.pq4_lut.data(), st.pq4_bias, st.pq4_scale);
+            st.pq4_scores.resize(((M_max0 + PQ4_BLOCK - 1) / PQ4_BLOCK) * PQ4_BLOCK);
+        }
+
+        select_entry_points(st.query, entry_buf);
+        if ((int)entry_buf.size() > ef)
+            st.W.resize(entry_buf.size());
+        for (int ep : entry_buf)
+        {
+            st.visited->mark(ep);
+            float d = traversal_dist(st, ep);
+            st.W[st.W_size++] = {d, ep};
+            st.heap.push_back({d, ep});
+        }
+        sort(st.W.begin(), st.W.begin() + st.W_size,
+             [](const Candidate &a, const Candidate &b) { return a.dist < b.dist; });
+        st.W_size = min(st.W_size, ef);
+        make_heap(st.heap.begin(), st.heap.end(), greater<pair<float, int>>());
+        st.done = !advance(st);
+    }
+
+    int active = 0;
+    for (const auto &st : states)
+        active += st.done ? 0 : 1;
+
+    while (active > 0)
+    {
+        for (InterleavedQuery &st : states)
+        {
+            if (st.done)
+                continue;
+
+            // 1. 计算上一轮预取的邻居
+            bool topk_changed = false;
+            for (int i = 0; i < st.pending_count; ++i)
+            {
+                int neighbor_id = st.pending[i];
+                if (st.visited->is_visited(neighbor_id))
+                    continue;
+                // fast-scan 过滤 (被过滤的点不标记访问，见 search_layer_query)
+                if (st.pq4_bound < std::numeric_limits<float>::max() &&
+                    st.pq4_bias + st.pq4_scores[i] * st.pq4_scale > st.pq4_bound)
+                    continue;
+                st.visited->mark(neighbor_id);
 
-    // 初始化入口点
-    for (int pid : ep)
+                float d = traversal_dist(st, neighbor_id);
+                if (st.W_size < ef || d < st.W[st.W_size - 1].dist)
+                {
+                    // 插入排序
+                    int pos = st.W_size;
+                    if (st.W_size < ef)
+                        st.W_size++;
+                    while (pos > 0 && st.W[pos - 1].dist > d)
+                    {
+                        if (pos < ef)
+                            st.W[pos] = st.W[pos - 1];
+                        pos--;
+                    }
+                    st.W[pos] = {d, neighbor_id};
+                    if (pos < TOP_K)
+                        topk_changed = true;
+
+                    st.heap.push_back({d, neighbor_id});
+                    push_heap(st.heap.begin(), st.heap.end(), greater<pair<float, int>>());
+                }
+            }
+
+            // 自适应终止 (与 search_layer_query 一致)
+            bool stop = false;
+            if (adaptive_patience > 0 && st.W_size >= TOP_K)
+            {
+                st.stable_expansions = topk_changed ? 0 : st.stable_expansions + 1;
+                stop = st.stable_expansions >= adaptive_patience;
+            }
+
+            // 2. 推进到下一个候选 (发出预取后切换查询)
+            if (stop || !advance(st))
+            {
+                st.done = true;
+                active--;
+            }
+        }
+    }
+
+    // 重排并输出
+    vector<int> candidates;
+    for (const InterleavedQuery &st : states)
+    {
+        if (st.cached)
+            continue;
+        candidates.clear();
+        for (int i = 0; i < st.W_size; ++i)
+            candidates.push_back(st.W[i].id);
+        narrow_binary_candidates(st.quant.data(), candidates);
+        rerank_topk(st.raw, candidates, st.res);
+        if (result_cache)
+            result_cache->insert(st.cache_key, st.cache_code, st.res);
+    }
+}
+
+// --- 单查询并行搜索 (intra-query) ---
+// 多个线程并发展开同一查询的不同前沿候选:
+//   visited 为共享原子标记数组 (exchange 抢占)，候选堆与结果集由一把锁保护，
+//   线程在锁外读取邻接表并计算距离，只把可能进入结果集的点批量提交。
+// 当堆空或堆顶已劣于结果集最差值、且没有线程仍在展开时结束。
+// 共享 visited 只能服务一个查询，因此并行查询之间互斥。
+struct Solution::IntraQueryState
+{
+    std::mutex search_mutex;
+    unique_ptr<std::atomic<int>[]> visited;
+    size_t visited_size = 0;
+    int tag = 0;
+
+    void prepare(int num_nodes)
+    {
+        if (visited_size < (size_t)num_nodes)
+        {
+            visited.reset(new std::atomic<int>[num_nodes]);
+            for (int i = 0; i < num_nodes; ++i)
+                visited[i].store(0, std::memory_order_relaxed);
+            visited_size = num_nodes;
+            tag = 0;
+        }
+        tag++;
+        if (tag == 0)
+        { // 溢出重置
+            for (size_t i = 0; i < visited_size; ++i)
+                visited[i].store(0, std::memory_order_relaxed);
+            tag = 1;
+        }
+    }
+};
+
+void Solution::search_intra_parallel(const vector<float> &query, int *res, int num_threads)
+{
+    if (num_vectors == 0)
+        return;
+    // 单线程、SSD 模式与小索引 (精确回退) 走 search，结果与入口无关
+    if (num_threads <= 1 || disk || num_vectors <= EXACT_FALLBACK_MAX)
+    {
+        search(query, res);
+        return;
+    }
+
+    {
+        static std::mutex init_mutex;
+        std::lock_guard<std::mutex> lock(init_mutex);
+        if (!intra_state)
+            intra_state = make_shared<IntraQueryState>();
+    }
+    IntraQueryState &shared = *intra_state;
+    std::lock_guard<std::mutex> serial(shared.search_mutex);
+    shared.prepare(num_vectors);
+    const int tag = shared.tag;
+
+    const float *q = traversal_query(query.data());
+    const int ef = query_ef();
+    vector<int> eps;
+    select_entry_points(q, eps);
+
+    // Layer 0 遍历距离与 fast-scan 过滤 (与 search_layer_query 一致)
+    const bool binary = !data_binary.empty();
+    const bool fastscan = !binary && !pq4_blocks.empty();
+    vector<uint64_t> q_bits;
+    vector<uint8_t> pq4_lut;
+    float pq4_bias = 0.0f, pq4_scale = 1.0f;
+    if (binary)
+    {
+        q_bits.resize(binary_words);
+        encode_binary(q, q_bits.data());
+    }
+    if (fastscan)
+    {
+        pq4_lut.resize((size_t)pq4_subspaces * PQ4_KSUB);
+        build_pq4_lut(q, pq4_lut.data(), pq4_bias, pq4_scale);
+    }
+    auto traversal_dist = [&](int id, float bound) -> float
+    {
+        if (binary)
+            return (float)hamming_distance(q_bits.data(), &data_binary[(size_t)id * binary_words], binary_words);
+        return dist_query_bounded(q, id, bound);
+    };
+
+    // 共享结果集 (升序) 与候选最小堆
+    vector<Candidate> W(max(ef, (int)eps.size()));
+    int W_size = 0;
+    vector<pair<float, int>> heap;
+    int expanding = 0;
+    std::mutex state_mutex;
+
+    for (int ep : eps)
+    {
+        shared.visited[ep].store(tag, std::memory_order_relaxed);
+        float d_ep = traversal_dist(ep, std::numeric_limits<float>::max());
+        W[W_size++] = {d_ep, ep};
+        heap.push_back({d_ep, ep});
+    }
+    sort(W.begin(), W.begin() + W_size,
+         [](const Candidate &a, const Candidate &b) { return a.dist < b.dist; });
+    W_size = min(W_size, ef);
+    make_heap(heap.begin(), heap.end(), greater<pair<float, int>>());
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(num_threads)
+#endif
+    {
+        vector<pair<float, int>> local;
+        vector<uint16_t> pq4_scores(fastscan ? ((M_max0 + PQ4_BLOCK - 1) / PQ4_BLOCK) * PQ4_BLOCK : 0);
+        int adj_buf[ADJ_DECODE_CAPACITY];
+        while (true)
+        {
+            int nid;
+            float bound;
+            {
+                std::unique_lock<std::mutex> lock(state_mutex);
+                // 堆顶已劣于结果集最差值: 剩余候选全部无效
+                if (!heap.empty() && W_size == ef && heap.front().first > W[W_size - 1].dist)
+                    heap.clear();
+                if (heap.empty())
+                {
+                    if (expanding == 0)
+                        break;
+                    lock.unlock();
+                    std::this_thread::yield();
+                    continue;
+                }
+                pop_heap(heap.begin(), heap.end(), greater<pair<float, int>>());
+                nid = heap.back().second;
+                heap.pop_back();
+                expanding++;
+                bound = (W_size == ef) ? W[W_size - 1].dist : std::numeric_limits<float>::max();
+            }
+
+            // 锁外展开
+            int neighbors_count;
+            const int *neighbors_ptr = layer0_neighbors(nid, adj_buf, neighbors_count);
+            float pq4_bound = std::numeric_limits<float>::max();
+            if (fastscan && bound < std::numeric_limits<float>::max())
+            {
+                pq4_scan_neighbors(nid, neighbors_count, pq4_lut.data(), pq4_scores.data());
+                pq4_bound = bound * PQ4_SLACK;
+            }
+            local.clear();
+            for (int i = 0; i < neighbors_count; ++i)
+            {
+                if (pf_distance > 0 && i + pf_distance < neighbors_count)
+                {
+                    if (binary)
+                        _mm_prefetch((const char *)&data_binary[(size_t)neighbors_ptr[i + pf_distance] * binary_words],
+                                     _MM_HINT_T0);
+                    else
+                        prefetch_vector(neighbors_ptr[i + pf_distance]);
+                }
+
+                int neighbor_id = neighbors_ptr[i];
+                // fast-scan 过滤在抢占标记之前 (被过滤的点保持未访问，见 search_layer_query)
+                if (pq4_bound < std::numeric_limits<float>::max() &&
+                    pq4_bias + pq4_scores[i] * pq4_scale > pq4_bound)
+                    continue;
+                if (shared.visited[neighbor_id].exchange(tag, std::memory_order_relaxed) == tag)
+                    continue;
+                float d = traversal_dist(neighbor_id, bound);
+                if (d < bound)
+                    local.push_back({d, neighbor_id});
+            }
+
+            // 批量提交
+            {
+                std::lock_guard<std::mutex> lock(state_mutex);
+                for (const auto &c : local)
+                {
+                    if (W_size < ef || c.first < W[W_size - 1].dist)
+                    {
+                        // 插入排序
+                        int pos = W_size;
+                        if (W_size < ef)
+                            W_size++;
+                        while (pos > 0 && W[pos - 1].dist > c.first)
+                        {
+                            if (pos < ef)
+                                W[pos] = W[pos - 1];
+                            pos--;
+                        }
+                        W[pos] = {c.first, c.second};
+                        heap.push_back(c);
+                        push_heap(heap.begin(), heap.end(), greater<pair<float, int>>());
+                    }
+                }
+                expanding--;
+            }
+        }
+    }
+
+    vector<int> candidates;
+    candidates.reserve(W_size);
+    for (int i = 0; i < W_size; ++i)
+        candidates.push_back(W[i].id);
+    tls_quant_query_buf.resize(dimension);
+    quantize_vec(q, tls_quant_query_buf.data());
+    narrow_binary_candidates(tls_quant_query_buf.data(), candidates);
+    rerank_topk(data_full.empty() ? q : query.data(), candidates, res);
+}
+
+// --- 自适应终止校准 ---
+// 以完整 ef 的结果为参照 (无需 ground truth)，二分查找达到 target_recall 的最小 patience
+int Solution::calibrate_adaptive_termination(const vector<vector<float>> &sample_queries, float target_recall)
+{
+    if (sample_queries.empty() || num_vectors == 0)
+        return adaptive_patience;
+
+    const int num_samples = (int)sample_queries.size();
+    vector<int> reference((size_t)num_samples * TOP_K);
+    adaptive_patience = 0;
+    for (int q = 0; q < num_samples; ++q)
+        search(sample_queries[q], &reference[(size_t)q * TOP_K]);
+
+    auto recall_at = [&](int patience) -> float
+    {
+        adaptive_patience = patience;
+        int hits = 0;
+        int res[TOP_K];
+        for (int q = 0; q < num_samples; ++q)
+        {
+            search(sample_queries[q], res);
+            const int *ref = &reference[(size_t)q * TOP_K];
+            for (int a = 0; a < TOP_K; ++a)
+            {
+                for (int b = 0; b < TOP_K; ++b)
+                {
+                    if (res[a] == ref[b])
+                    {
+                        hits++;
+                        break;
+                    }
+                }
+            }
+        }
+        return (float)hits / (num_samples * TOP_K);
+    };
+
+    // patience 取值上界: 达不到目标时退回完整搜索
+    int lo = 1, hi = 256;
+    if (recall_at(hi) < target_recall)
+    {
+        adaptive_patience = 0;
+        return 0;
+    }
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (recall_at(mid) >= target_recall)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    adaptive_patience = lo;
+    return lo;
+}
+
+// --- NUMA 感知的批量查询 ---
+// 拓扑: Linux 下读取 /sys/devices/system/node (USE_LIBNUMA 时改用 libnuma)，其他平台视为单节点。
+// 副本: 每个节点一个只读查询结构副本，由绑定到该节点的线程复制 (first-touch 落在本地内存)。
+// 路由: 批量查询按节点 CPU 数切分，每段只由本节点线程处理并访问本节点副本。
+
+struct NumaNodeInfo
+{
+    int node_id;
+    vector<int> cpus; // 为空表示不绑核
+};
+
+#ifdef __linux__
+// 解析 "0-3,8-11" 格式的列表
+static vector<int> parse_cpu_list(const string &text)
+{
+    vector<int> ids;
+    size_t pos = 0;
+    while (pos < text.size())
+    {
+        size_t comma = text.find(',', pos);
+        string item = text.substr(pos, comma == string::npos ? string::npos : comma - pos);
+        size_t dash = item.find('-');
+        if (!item.empty() && isdigit((unsigned char)item[0]))
+        {
+            int lo = atoi(item.c_str());
+            int hi = dash == string::npos ? lo : atoi(item.c_str() + dash + 1);
+            for (int c = lo; c <= hi; ++c)
+                ids.push_back(c);
+        }
+        if (comma == string::npos)
+            break;
+        pos = comma + 1;
+    }
+    return ids;
+}
+
+static string read_sysfs_line(const string &path)
+{
+    string line;
+    ifstream in(path);
+    if (in.is_open())
+        getline(in, line);
+    return line;
+}
+#endif
+
+static vector<NumaNodeInfo> detect_numa_topology()
+{
+    vector<NumaNodeInfo> topo;
+#if defined(USE_LIBNUMA)
+    if (numa_available() >= 0)
+    {
+        struct bitmask *mask = numa_allocate_cpumask();
+        for (int n = 0; n <= numa_max_node(); ++n)
+        {
+            if (numa_node_to_cpus(n, mask) != 0)
+                continue;
+            NumaNodeInfo info{n, {}};
+            for (unsigned int c = 0; c < mask->size; ++c)
+            {
+                if (numa_bitmask_isbitset(mask, c))
+                    info.cpus.push_back((int)c);
+            }
+            if (!info.cpus.empty())
+                topo.push_back(info);
+        }
+        numa_free_cpumask(mask);
+    }
+#elif defined(__linux__)
+    vector<int> online = parse_cpu_list(read_sysfs_line("/sys/devices/system/node/online"));
+    for (int n : online)
+    {
+        NumaNodeInfo info{n, parse_cpu_list(read_sysfs_line(
+                                 "/sys/devices/system/node/node" + to_string(n) + "/cpulist"))};
+        if (!info.cpus.empty())
+            topo.push_back(info);
+    }
+#endif
+    if (topo.empty())
+    {
+        // 回退: 单节点，不绑核
+        topo.push_back({0, {}});
+    }
+    return topo;
+}
+
+// 将当前线程绑定到节点的 CPU 集合，并让后续分配优先落在该节点
+static void bind_current_thread(const NumaNodeInfo &node)
+{
+#if defined(USE_LIBNUMA)
+    if (numa_available() >= 0)
+    {
+        numa_run_on_node(node.node_id);
+        numa_set_preferred(node.node_id);
+        return;
+    }
+#endif
+#ifdef __linux__
+    if (node.cpus.empty())
+        return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int c : node.cpus)
+    {
+        if (c < CPU_SETSIZE)
+            CPU_SET(c, &set);
+    }
+    sched_setaffinity(0, sizeof(set), &set);
+#else
+    (void)node;
+#endif
+}
+
+// 只复制查询所需的结构 (Layer 0 已在 final_graph_flat，上层邻接表不含 Layer 0)
+void Solution::copy_query_structures(const Solution &src)
+{
+    dimension = src.dimension;
+    full_dimension = src.full_dimension;
+    num_vectors = src.num_vectors;
+    data_flat = src.data_flat;
+    data_full = src.data_full;
+    proj_matrix = src.proj_matrix;
+    dim_order = src.dim_order;
+    early_abandon = src.early_abandon;
+    proj_variance_retained = src.proj_variance_retained;
+    data_half = src.data_half;
+    data_quant = src.data_quant;
+    data_norms = src.data_norms;
+    data_binary = src.data_binary;
+    binary_threshold = src.binary_threshold;
+    binary_rotation = src.binary_rotation;
+    binary_words = src.binary_words;
+    pq4_subspaces = src.pq4_subspaces;
+    pq4_sub_begin = src.pq4_sub_begin;
+    pq4_centroids = src.pq4_centroids;
+    pq4_blocks = src.pq4_blocks;
+    pq4_block_offsets = src.pq4_block_offsets;
+    global_min = src.global_min;
+    global_scale_inv = src.global_scale_inv;
+    use_quantization = src.use_quantization;
+    vector_storage = src.vector_storage;
+    keep_fp32_rerank = src.keep_fp32_rerank;
+
+    nodes.resize(src.nodes.size());
+    for (size_t i = 0; i < src.nodes.size(); ++i)
+    {
+        const auto &levels = src.nodes[i].neighbors;
+        nodes[i].neighbors.resize(levels.size());
+        for (size_t lc = 1; lc < levels.size(); ++lc)
+            nodes[i].neighbors[lc] = levels[lc];
+    }
+    final_graph_flat = src.final_graph_flat;
+    graph_packed = src.graph_packed;
+    final_graph_offsets = src.final_graph_offsets;
+
+    max_level = src.max_level;
+    enter_point = src.enter_point;
+    M_max = src.M_max;
+    M_max0 = src.M_max0;
+    custom_ef_search = src.custom_ef_search;
+    batch_interleave = src.batch_interleave;
+    adaptive_patience = src.adaptive_patience;
+    pf_distance = src.pf_distance;
+    pf_lines = src.pf_lines;
+    adj_lines = src.adj_lines;
+    entry_centroids = src.entry_centroids;
+    entry_nodes = src.entry_nodes;
+    entry_seeds = src.entry_seeds;
+    entry_skip_upper = src.entry_skip_upper;
+    upper_ids = src.upper_ids;
+    upper_adj = src.upper_adj;
+    upper_offsets = src.upper_offsets;
+    upper_vectors = src.upper_vectors;
+    upper_quant = src.upper_quant;
+    upper_enter = src.upper_enter;
+    disk = src.disk;
+}
+
+int Solution::enable_numa_replicas()
+{
+    numa_replicas.clear();
+    vector<NumaNodeInfo> topo = detect_numa_topology();
+    numa_replicas.resize(topo.size());
+
+    // 各节点并行复制，复制线程绑定在目标节点上
+    vector<std::thread> workers;
+    for (size_t n = 0; n < topo.size(); ++n)
+    {
+        workers.emplace_back([this, n, &topo]()
+                             {
+            bind_current_thread(topo[n]);
+            auto replica = make_shared<Solution>();
+            replica->copy_query_structures(*this);
+            numa_replicas[n] = replica; });
+    }
+    for (auto &t : workers)
+        t.join();
+
+    // 查询线程池: 每个 (本进程可用的) 节点 CPU 一个线程，线程与副本的对应关系固定
+    vector<int> pool_cpus;
+    numa_worker_replica.clear();
+#ifdef __linux__
+    vector<int> allowed = allowed_cpus();
+    for (size_t n = 0; n < topo.size(); ++n)
+    {
+        for (int c : topo[n].cpus)
+        {
+            if (find(allowed.begin(), allowed.end(), c) != allowed.end())
+            {
+                pool_cpus.push_back(c);
+                numa_worker_replica.push_back((int)n);
+            }
+        }
+    }
+#endif
+    if (pool_cpus.empty())
+    {
+        // 拓扑未知: 单副本，不绑核
+        numa_replicas.resize(1);
+        numa_pool = make_shared<WorkStealingPool>();
+        numa_worker_replica.assign(numa_pool->concurrency(), 0);
+    }
+    else
+    {
+        numa_pool = make_shared<WorkStealingPool>(pool_cpus);
+    }
+    return (int)numa_replicas.size();
+}
+
+void Solution::disable_numa_replicas()
+{
+    numa_replicas.clear();
+    numa_pool.reset();
+    numa_worker_replica.clear();
+}
+
+void Solution::search_batch(const vector<vector<float>> &queries, int *res)
+{
+    const int num_queries = (int)queries.size();
+    if (num_queries == 0)
+        return;
+
+    // 有副本时由绑核线程池执行，每个线程只读本节点副本 (副本共享本实例的结果缓存)；
+    // 否则经执行器在共享索引上并行。每个任务一组交错查询
+    // 小索引: 与 search 的精确回退一致，整批交给分块精确引擎
+    if (!disk && num_vectors <= EXACT_FALLBACK_MAX)
+    {
+        search_batch_exact(queries, res);
+        return;
+    }
+
+    Executor &exec = numa_replicas.empty() ? executor() : *numa_pool;
+    for (auto &replica : numa_replicas)
+        replica->result_cache = result_cache;
+    const int group = disk ? 1 : max(1, batch_interleave); // SSD 模式只走逐个查询路径
+    const int num_groups = (num_queries + group - 1) / group;
+    exec.parallel_for(0, num_groups, 1, [&](int g, int worker)
+    {
+        Solution *target = numa_replicas.empty() ? this : numa_replicas[numa_worker_replica[worker]].get();
+        int q_begin = g * group;
+        int q_end = min(num_queries, q_begin + group);
+        if (group == 1)
+            target->search(queries[q_begin], res + (size_t)q_begin * 10);
+        else
+            target->search_group(queries, q_begin, q_end, res);
+    });
+}
+
+// 小索引的批量查询: 先逐查询查结果缓存 (键与 search 相同)，未命中的查询一次性精确搜索
+void Solution::search_batch_exact(const vector<vector<float>> &queries, int *res)
+{
+    const int num_queries = (int)queries.size();
+    vector<vector<float>> bufs(num_queries);
+    vector<const float *> q_ptrs(num_queries);
+    vector<vector<unsigned char>> codes(result_cache ? num_queries : 0);
+    vector<uint64_t> keys(codes.size());
+    vector<char> hit(num_queries, 0);
+    executor().parallel_for(0, num_queries, 64, [&](int q, int)
+    {
+        q_ptrs[q] = index_query(queries[q].data(), bufs[q]);
+        if (!result_cache)
+            return;
+        const float *tq = traversal_query(queries[q].data());
+        tls_quant_query_buf.resize(dimension);
+        quantize_vec(tq, tls_quant_query_buf.data());
+        make_cache_code(tq, tls_quant_query_buf.data(), use_quantization, dimension, query_ef(),
+                        adaptive_patience, codes[q]);
+        keys[q] = ResultCache::hash(codes[q]);
+        hit[q] = result_cache->lookup(keys[q], codes[q], res + (size_t)q * 10);
+    });
+
+    vector<int> miss;
+    vector<const float *> miss_ptrs;
+    for (int q = 0; q < num_queries; ++q)
+    {
+        if (!hit[q])
+        {
+            miss.push_back(q);
+            miss_ptrs.push_back(q_ptrs[q]);
+        }
+    }
+    if (miss.empty())
+        return;
+    vector<int> miss_res(miss.size() * TOP_K);
+    exact_search(miss_ptrs.data(), (int)miss.size(), TOP_K, miss_res.data(), nullptr, nullptr, &executor());
+    for (size_t m = 0; m < miss.size(); ++m)
+    {
+        int *out = res + (size_t)miss[m] * 10;
+        memcpy(out, &miss_res[m * TOP_K], TOP_K * sizeof(int));
+        if (result_cache)
+            result_cache->insert(keys[miss[m]], codes[miss[m]], out);
+    }
+}
+
+// =========================================================
+// 精确 kNN 引擎 (分块 GEMM 式内核)
+// =========================================================
+// ||q - x||² = ||q||² - 2 q·x + ||x||²：EXACT_QUERY_TILE 个查询为一组，与 EXACT_BASE_TILE 个基向量
+// 组成的块做点积 (每个基向量分量只加载一次，供整组查询 FMA)，每个查询维护大小为 k 的有界最大堆。
+// 任务 = (查询组, 基向量分片)；查询组少于线程数时按基向量分片并行，最后逐查询归并。
+// 并行经由传入的执行器 (为空时串行)，不自行开 OpenMP 线程组: 单查询 search 已在调用方的线程上并行。
+
+// 点积: TILE 个查询 x 一个基向量 (TILE 为编译期常量，累加器全部留在寄存器)
+template <int TILE>
+static inline void dot_query_tile(const float *const *q, const float *x, int d, float *out)
+{
+    int j = 0;
+#if defined(__AVX2__)
+    __m256 acc[TILE];
+    for (int t = 0; t < TILE; ++t)
+        acc[t] = _mm256_setzero_ps();
+    for (; j + 8 <= d; j += 8)
+    {
+        __m256 xv = _mm256_loadu_ps(x + j);
+        for (int t = 0; t < TILE; ++t)
+            acc[t] = _mm256_fmadd_ps(_mm256_loadu_ps(q[t] + j), xv, acc[t]);
+    }
+    for (int t = 0; t < TILE; ++t)
+    {
+        __m128 s = _mm_add_ps(_mm256_castps256_ps128(acc[t]), _mm256_extractf128_ps(acc[t], 1));
+        s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+        s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 0x55));
+        out[t] = _mm_cvtss_f32(s);
+    }
+#else
+    for (int t = 0; t < TILE; ++t)
+        out[t] = 0.0f;
+#endif
+    for (; j < d; ++j)
+    {
+        for (int t = 0; t < TILE; ++t)
+            out[t] += q[t][j] * x[j];
+    }
+}
+
+static inline void dot_query_tile(const float *const *q, int tile, const float *x, int d, float *out)
+{
+    if (tile == EXACT_QUERY_TILE)
+    {
+        dot_query_tile<EXACT_QUERY_TILE>(q, x, d, out);
+        return;
+    }
+    for (int t = 0; t < tile; ++t)
+        dot_query_tile<1>(q + t, x, d, out + t);
+}
+
+// get_block(start, count, scratch): 返回第 [start, start + count) 个基向量的连续 FP32 数据
+// (可直接指向原数组，或解码/收集到 scratch)；id_of(i) 把块内序号映射为输出 id
+// base_norms: 预先算好的 ||x||² (可为空，此时先扫描一遍计算)
+template <class BlockFn, class IdFn>
+static void exact_knn_engine(int n, int d, BlockFn get_block, IdFn id_of, const float *base_norms,
+                             const float *const *queries, int nq, int k, int *res, float *dists, Executor *exec)
+{
+    if (nq == 0 || k <= 0)
+        return;
+    const int num_blocks = (n + EXACT_BASE_TILE - 1) / EXACT_BASE_TILE;
+    const int threads = exec ? max(1, exec->concurrency()) : 1;
+    auto parallel_for = [&](int begin, int end, int grain, const function<void(int, int)> &body)
+    {
+        if (exec)
+            exec->parallel_for(begin, end, grain, body);
+        else
+            for (int i = begin; i < end; ++i)
+                body(i, 0);
+    };
+
+    // 1. 基向量范数
+    vector<float> computed_norms;
+    if (!base_norms)
+    {
+        computed_norms.resize(n);
+        vector<vector<float>> scratch(threads);
+        parallel_for(0, num_blocks, 1, [&](int b, int w)
+        {
+            scratch[w].resize((size_t)EXACT_BASE_TILE * d);
+            int start = b * EXACT_BASE_TILE;
+            int count = min(EXACT_BASE_TILE, n - start);
+            const float *block = get_block(start, count, scratch[w].data());
+            for (int i = 0; i < count; ++i)
+                computed_norms[start + i] = squared_norm(block + (size_t)i * d, d);
+        });
+        base_norms = computed_norms.data();
+    }
+
+    // 2. 任务划分
+    const int groups = (nq + EXACT_QUERY_TILE - 1) / EXACT_QUERY_TILE;
+    const int slices = max(1, min(num_blocks, (threads + groups - 1) / groups));
+    const int tasks = groups * slices;
+    // heaps[task][tile] : (dist, id) 最大堆
+    vector<vector<pair<float, int>>> heaps((size_t)tasks * EXACT_QUERY_TILE);
+
+    parallel_for(0, tasks, 1, [&](int task, int)
+    {
+        const int g = task / slices, s = task % slices;
+        const int q_begin = g * EXACT_QUERY_TILE;
+        const int tile = min(EXACT_QUERY_TILE, nq - q_begin);
+        const int b_begin = (int)((long long)num_blocks * s / slices);
+        const int b_end = (int)((long long)num_blocks * (s + 1) / slices);
+
+        const float *q[EXACT_QUERY_TILE];
+        float q_norm[EXACT_QUERY_TILE];
+        for (int t = 0; t < tile; ++t)
+        {
+            q[t] = queries[q_begin + t];
+            q_norm[t] = squared_norm(q[t], d);
+        }
+        vector<pair<float, int>> *task_heaps = &heaps[(size_t)task * EXACT_QUERY_TILE];
+        vector<float> scratch((size_t)EXACT_BASE_TILE * d);
+        float dot[EXACT_QUERY_TILE];
+
+        for (int b = b_begin; b < b_end; ++b)
+        {
+            int start = b * EXACT_BASE_TILE;
+            int count = min(EXACT_BASE_TILE, n - start);
+            const float *block = get_block(start, count, scratch.data());
+            for (int i = 0; i < count; ++i)
+            {
+                dot_query_tile(q, tile, block + (size_t)i * d, d, dot);
+                const float x_norm = base_norms[start + i];
+                for (int t = 0; t < tile; ++t)
+                {
+                    float dist = max(0.0f, q_norm[t] - 2.0f * dot[t] + x_norm);
+                    vector<pair<float, int>> &h = task_heaps[t];
+                    if ((int)h.size() < k)
+                    {
+                        h.push_back({dist, start + i});
+                        push_heap(h.begin(), h.end());
+                    }
+                    else if (dist < h.front().first)
+                    {
+                        pop_heap(h.begin(), h.end());
+                        h.back() = {dist, start + i};
+                        push_heap(h.begin(), h.end());
+                    }
+                }
+            }
+        }
+    });
+
+    // 3. 归并各分片的堆
+    parallel_for(0, nq, 64, [&](int qi, int)
     {
-        if (!tls_visited.is_visited(pid))
+        const int g = qi / EXACT_QUERY_TILE, t = qi % EXACT_QUERY_TILE;
+        vector<pair<float, int>> merged;
+        for (int s = 0; s < slices; ++s)
         {
-            tls_visited.mark(pid);
-            float dist = dist_l2_float_avx(query, &data_flat[pid * dimension], dimension);
-            C.push({dist, pid});
-            W.push({dist, pid});
-            if (W.size() > ef)
-                W.pop();
+            const auto &h = heaps[(size_t)(g * slices + s) * EXACT_QUERY_TILE + t];
+            merged.insert(merged.end(), h.begin(), h.end());
+        }
+        size_t top = min<size_t>(k, merged.size());
+        partial_sort(merged.begin(), merged.begin() + top, merged.end());
+        for (int j = 0; j < k; ++j)
+        {
+            const auto &r = merged.empty() ? make_pair(0.0f, 0) : merged[min<size_t>(j, top - 1)];
+            res[(size_t)qi * k + j] = merged.empty() ? 0 : id_of(r.second);
+            if (dists)
+                dists[(size_t)qi * k + j] = r.first;
         }
+    });
+}
+
+void Solution::exact_knn(const float *base, int n, int d, const vector<vector<float>> &queries, int k, int *res,
+                         float *dists)
+{
+    vector<const float *> q_ptrs(queries.size());
+    for (size_t i = 0; i < queries.size(); ++i)
+        q_ptrs[i] = queries[i].data();
+    exact_knn_engine(
+        n, d, [&](int start, int, float *) { return base + (size_t)start * d; }, [](int i) { return i; }, nullptr,
+        q_ptrs.data(), (int)q_ptrs.size(), k, res, dists, &default_executor());
+}
+
+bool Solution::write_groundtruth(const string &path, const vector<float> &base, int d,
+                                 const vector<vector<float>> &queries, int k)
+{
+    if (d <= 0)
+        return false;
+    vector<int> res(queries.size() * k);
+    exact_knn(base.data(), base.size() / d, d, queries, k, res.data(), nullptr);
+
+    ofstream out(path);
+    if (!out)
+        return false;
+    for (size_t q = 0; q < queries.size(); ++q)
+    {
+        for (int j = 0; j < k; ++j)
+            out << res[q * k + j] << (j + 1 < k ? " " : "\n");
     }
+    return (bool)out;
+}
 
-    while (!C.empty())
+// 索引内精确搜索: 基向量按存储格式取块 (半精度时逐块解码；投影模式用全维 data_full)；
+// subset 非空时只在其中搜索；exec 为空时串行 (单查询接口，由调用方在查询间并行)
+void Solution::exact_search(const float *const *queries, int nq, int k, int *res, float *dists,
+                            const vector<int> *subset, Executor *exec) const
+{
+    const int n = subset ? (int)subset->size() : num_vectors;
+    const bool projected = !data_full.empty();
+    const int d = projected ? full_dimension : dimension;
+    const float *flat = projected ? data_full.data() : (data_flat.empty() ? nullptr : data_flat.data());
+    auto get_block = [&](int start, int count, float *scratch) -> const float *
     {
-        auto curr = C.top();
-        C.pop();
-        float dist_c = curr.first;
-        int id_c = curr.second;
+        if (!subset && flat)
+            return flat + (size_t)start * d;
+        for (int i = 0; i < count; ++i)
+        {
+            int id = subset ? (*subset)[start + i] : start + i;
+            float *dst = scratch + (size_t)i * d;
+            const float *v = flat ? flat + (size_t)id * d : get_vector(id, dst);
+            if (v != dst)
+                memcpy(dst, v, d * sizeof(float));
+        }
+        return scratch;
+    };
+    auto id_of = [&](int i) { return subset ? (*subset)[i] : i; };
+    const float *norms = (!subset && !data_norms.empty()) ? data_norms.data() : nullptr;
+    exact_knn_engine(n, d, get_block, id_of, norms, queries, nq, k, res, dists, exec);
+}
 
-        if (dist_c > W.top().first)
-            break; // 剪枝
+void Solution::search_exact_batch(const vector<vector<float>> &queries, int *res, int k) const
+{
+    if (num_vectors == 0 || disk)
+        return;
+    vector<vector<float>> bufs(dim_order.empty() ? 0 : queries.size());
+    vector<const float *> q_ptrs(queries.size());
+    for (size_t i = 0; i < queries.size(); ++i)
+        q_ptrs[i] = dim_order.empty() ? queries[i].data() : index_query(queries[i].data(), bufs[i]);
+    exact_search(q_ptrs.data(), (int)q_ptrs.size(), k, res, nullptr, nullptr, &executor());
+}
 
-        // 遍历邻居
-        const vector<int> &neighbors = nodes[id_c].neighbors[lc];
+void Solution::search_exact_subset(const vector<float> &query, const vector<int> &ids, int *res) const
+{
+    if (ids.empty() || disk)
+        return;
+    vector<float> buf;
+    const float *q = index_query(query.data(), buf);
+    exact_search(&q, 1, TOP_K, res, nullptr, &ids);
+}
 
-        // 预取优化 (Optimization 6)
-        for (size_t i = 0; i < neighbors.size(); ++i)
-        {
-            int nid = neighbors[i];
-            if (tls_visited.is_visited(nid))
-                continue;
-            tls_visited.mark(nid);
+// 精确暴力搜索 (验证 HNSW 结果)
+void Solution::search_brute_force(const vector<float> &query, int *res) const
+{
+    if (num_vectors == 0 || disk)
+        return;
+    vector<float> buf;
+    const float *q = index_query(query.data(), buf);
+    exact_search(&q, 1, TOP_K, res, nullptr, nullptr);
+}
 
-            // Prefetch next
-            if (i + 1 < neighbors.size())
-            {
-                _mm_prefetch((const char *)&data_flat[neighbors[i + 1] * dimension], _MM_HINT_T0);
-            }
+// =========================================================
+// SSD 常驻模式 (DiskANN 风格)
+// =========================================================
+// 文件布局: [4 KiB 头][节点 0 记录][节点 1 记录]...
+// 记录 = [count][邻居 x max_neighbors][FP32 向量]，按目标文件系统的 O_DIRECT 偏移对齐补齐
+// (至少 DISK_ALIGN)，4Kn 设备上即为 4 KiB；打开时对齐不满足则退回缓冲读。
+// 打开后内存中只保留 SQ8 码、紧凑高层与热点节点缓存；Layer 0 以 beam 为单位批量读盘。
 
-            float d = dist_l2_float_avx(query, &data_flat[nid * dimension], dimension);
+static const uint64_t DISK_MAGIC = 0x31584449534e4848ULL; // "HHNSIDX1"
+static const size_t DISK_HEADER_SIZE = 4096;
+static const size_t DISK_ALIGN = 512;      // 记录的最小对齐粒度
+static const size_t DISK_BUF_ALIGN = 4096; // 读缓冲的内存对齐 (覆盖常见的 O_DIRECT 内存对齐要求)
+static const int DISK_BEAM_WIDTH = 4;      // 每轮展开并读取的节点数
+static const int DISK_IO_THREADS = 4;      // pread 线程池大小
 
-            if (W.size() < ef || d < W.top().first)
-            {
-                W.push({d, nid});
-                C.push({d, nid});
-                if (W.size() > ef)
-                    W.pop();
-            }
-        }
-    }
+struct DiskHeader
+{
+    uint64_t magic;
+    int32_t dimension;
+    int32_t num_vectors;
+    int32_t max_neighbors;
+    int32_t reserved;
+    uint64_t record_size;
+};
 
-    // 收集结果
-    candidates.clear();
-    while (!W.empty())
+// 一次批量读请求
+struct DiskRead
+{
+    char *buf;
+    size_t size;
+    off_t offset;
+};
+
+static bool pread_full(int fd, char *buf, size_t size, off_t offset)
+{
+    size_t done = 0;
+    while (done < size)
     {
-        candidates.push_back(W.top().second);
-        W.pop();
+        ssize_t r = pread(fd, buf + done, size - done, offset + done);
+        if (r <= 0)
+            return false;
+        done += r;
     }
-    // W pop出来是降序，需要反转成升序以便后续处理 (虽然Heuristic里会重排，但保持有序好)
-    // 但Heuristic通常只需要集合。这里不用反转。
+    return true;
 }
 
-// 最终查询阶段使用的搜索 (Layer 0使用量化 + 扁平图)
-// [修复版本] 使用标准HNSW双堆逻辑，避免搜索提前终止
-void Solution::search_layer_query(const float *query, const unsigned char *query_quant,
-                                  vector<int> &candidates, const vector<int> &ep,
-                                  int ef, int lc) const
+// 异步读后端: 提交一批请求并等待全部完成
+struct DiskReader
 {
+    virtual ~DiskReader() {}
+    virtual bool read_batch(int fd, const vector<DiskRead> &reqs) = 0;
+};
 
-    tls_visited.prepare(num_vectors);
+// 回退实现: pread 线程池 (单个请求直接在调用线程读取)
+struct PreadPool : DiskReader
+{
+    struct Batch
+    {
+        std::mutex mutex;
+        std::condition_variable done;
+        int remaining = 0;
+        bool ok = true;
+    };
+    struct Job
+    {
+        int fd;
+        DiskRead req;
+        Batch *batch;
+    };
 
-    // 使用数组模拟堆，比STL快 (Optimization 5)
-    // W_arr: 结果集 (维持有序)
-    // 关键修复: 扩大缓冲区以支持 EF_SEARCH=800
-    Candidate W_arr[2048]; // 支持 ef <= 800+ (安全余地)
-    int W_size = 0;
+    std::mutex mutex;
+    std::condition_variable has_job;
+    deque<Job> jobs;
+    vector<std::thread> workers;
+    bool stopping = false;
 
-    // 辅助: 插入W
-    auto add_to_W = [&](int id, float d)
+    explicit PreadPool(int num_threads)
+    {
+        for (int i = 0; i < num_threads; ++i)
+            workers.emplace_back([this] { worker_loop(); });
+    }
+
+    ~PreadPool()
     {
-        if (W_size < ef || d < W_arr[W_size - 1].dist)
         {
-            // 插入排序
-            int pos = W_size;
-            if (W_size < ef)
-                W_size++;
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        has_job.notify_all();
+        for (auto &t : workers)
+            t.join();
+    }
 
-            while (pos > 0 && W_arr[pos - 1].dist > d)
+    void worker_loop()
+    {
+        while (true)
+        {
+            Job job;
             {
-                if (pos < ef)
-                    W_arr[pos] = W_arr[pos - 1];
-                pos--;
+                std::unique_lock<std::mutex> lock(mutex);
+                has_job.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (jobs.empty())
+                    return;
+                job = jobs.front();
+                jobs.pop_front();
             }
-            if (pos < ef)
-                W_arr[pos] = {d, id};
+            bool ok = pread_full(job.fd, job.req.buf, job.req.size, job.req.offset);
+            std::lock_guard<std::mutex> lock(job.batch->mutex);
+            job.batch->ok = job.batch->ok && ok;
+            if (--job.batch->remaining == 0)
+                job.batch->done.notify_one();
         }
-    };
-
-    // [性能重构] 替代 priority_queue：使用 thread_local vector + 手动堆管理
-    // 优势：零内存分配 (Zero Allocation)，消除动态内存开销
-    tls_candidate_queue.clear();
+    }
 
-    // 初始化
-    for (int pid : ep)
+    bool read_batch(int fd, const vector<DiskRead> &reqs) override
     {
-        if (!tls_visited.is_visited(pid))
+        if (reqs.size() == 1 || workers.empty())
         {
-            tls_visited.mark(pid);
-            float d;
-            // 关键修复：为提升召回率，Layer 0 也使用 Float 精确距离
-            // 量化距离误差会导致候选集质量下降，影响召回率
-            d = dist_l2_float_avx(query, &data_flat[pid * dimension], dimension);
-            add_to_W(pid, d);
-            tls_candidate_queue.push_back({d, pid});
+            bool ok = true;
+            for (const DiskRead &r : reqs)
+                ok = pread_full(fd, r.buf, r.size, r.offset) && ok;
+            return ok;
+        }
+
+        Batch batch;
+        batch.remaining = (int)reqs.size();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (const DiskRead &r : reqs)
+                jobs.push_back({fd, r, &batch});
         }
+        has_job.notify_all();
+        std::unique_lock<std::mutex> lock(batch.mutex);
+        batch.done.wait(lock, [&] { return batch.remaining == 0; });
+        return batch.ok;
     }
-    // 建立最小堆
-    make_heap(tls_candidate_queue.begin(), tls_candidate_queue.end(), greater<pair<float, int>>());
+};
 
-    while (!tls_candidate_queue.empty())
+#ifdef USE_LIBURING
+// io_uring: 每个查询线程一个 ring，一批请求一次提交
+struct UringReader : DiskReader
+{
+    bool read_batch(int fd, const vector<DiskRead> &reqs) override
     {
-        // 取堆顶（最小距离的候选点）
-        pop_heap(tls_candidate_queue.begin(), tls_candidate_queue.end(), greater<pair<float, int>>());
-        auto curr = tls_candidate_queue.back();
-        tls_candidate_queue.pop_back();
-
-        float dist_c = curr.first;
-        int nid = curr.second;
-
-        // 剪枝：当前最近的候选点比结果集中最远的点还远，且结果集已满
-        if (W_size == ef && dist_c > W_arr[W_size - 1].dist)
-            break;
-
-        // 获取邻居指针
-        const int *neighbors_ptr;
-        int neighbors_count;
-
-        if (lc == 0)
+        static thread_local struct io_uring ring;
+        static thread_local bool ring_ready = false;
+        if (!ring_ready)
         {
-            // Layer 0: 从扁平数组读取 (Optimization 4)
-            size_t offset = final_graph_offsets[nid];
-            neighbors_count = final_graph_flat[offset];
-            neighbors_ptr = &final_graph_flat[offset + 1];
+            if (io_uring_queue_init(DISK_BEAM_WIDTH * 4, &ring, 0) < 0)
+                return fallback(fd, reqs);
+            ring_ready = true;
         }
-        else
+
+        size_t submitted = 0;
+        for (const DiskRead &r : reqs)
         {
-            // High Layer: 从节点对象读取
-            const auto &vec = nodes[nid].neighbors[lc];
-            neighbors_ptr = vec.data();
-            neighbors_count = (int)vec.size();
+            struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+            if (!sqe)
+                break;
+            io_uring_prep_read(sqe, fd, r.buf, r.size, r.offset);
+            submitted++;
         }
+        io_uring_submit(&ring);
 
-        for (int i = 0; i < neighbors_count; ++i)
+        bool ok = true;
+        for (size_t i = 0; i < submitted; ++i)
         {
-            int neighbor_id = neighbors_ptr[i];
-            if (tls_visited.is_visited(neighbor_id))
-                continue;
-            tls_visited.mark(neighbor_id);
-
-            // Prefetch - 始终预取 Float 数据
-            if (lc == 0 && i + 2 < neighbors_count)
-            {
-                _mm_prefetch((const char *)&data_flat[neighbors_ptr[i + 2] * dimension], _MM_HINT_T0);
-            }
-
-            // 关键修复：始终使用 Float 精确距离计算
-            float d = dist_l2_float_avx(query, &data_flat[neighbor_id * dimension], dimension);
-
-            if (W_size < ef || d < W_arr[W_size - 1].dist)
-            {
-                add_to_W(neighbor_id, d);
-                // 手动堆 Push
-                tls_candidate_queue.push_back({d, neighbor_id});
-                push_heap(tls_candidate_queue.begin(), tls_candidate_queue.end(), greater<pair<float, int>>());
-            }
+            struct io_uring_cqe *cqe;
+            if (io_uring_wait_cqe(&ring, &cqe) < 0)
+                return fallback(fd, reqs);
+            ok = ok && cqe->res == (int)reqs[0].size;
+            io_uring_cqe_seen(&ring, cqe);
         }
+        // 短读或 ring 已满的剩余请求同步补读
+        if (!ok || submitted < reqs.size())
+            return fallback(fd, reqs);
+        return true;
     }
 
-    candidates.clear();
-    for (int i = 0; i < W_size; ++i)
+    static bool fallback(int fd, const vector<DiskRead> &reqs)
     {
-        candidates.push_back(W_arr[i].id);
+        bool ok = true;
+        for (const DiskRead &r : reqs)
+            ok = pread_full(fd, r.buf, r.size, r.offset) && ok;
+        return ok;
     }
-}
+};
+#endif
 
-// --- 选邻居策略 (RobustPrune) ---
-void Solution::get_neighbors_heuristic(vector<int> &result, const vector<int> &candidates, int k) const
+struct Solution::DiskIndex
 {
-    if (candidates.size() <= (size_t)k)
-    {
-        result = candidates;
-        return;
-    }
+    int fd = -1;
+    bool direct_io = false;
+    size_t record_size = 0;
+    int max_neighbors = 0;
 
-    // 1. 按距离排序候选集
-    vector<pair<float, int>> temp;
-    temp.reserve(candidates.size());
-    // 注意：这里需要精确距离，因为这发生在构建阶段
-    // 且candidates里的点距离query的距离需要重新计算或传递，为简单起见，这里假设base是当前插入节点
-    // 但HNSW构建中，heuristic是针对 query (即新插入点) 和 candidates 之间的关系
-    // 由于我们没有保存candidates的距离，这里简化处理：
-    // 标准实现中，get_neighbors_heuristic 需要计算 candidate 之间的距离来保证多样性
-    // 这里传入的 candidates 应该是已经按距离 query 排好序的，或者我们在外部排序
-
-    // 由于接口限制，我们在这里不重新计算 query 到 candidate 的距离，
-    // 而是假设调用者已经处理好，或者我们简化为只做多样性修剪
-    // *修正*: 为了保证召回率，必须实现 RobustPrune
-
-    // 这里我们实际上需要传入 query 的坐标来计算距离。
-    // 但为了不改变太多签名，我们假设 candidates 已经包含了最近的邻居。
-    // 在 build 过程中，select_neighbors 步骤传入的 candidates 确实是最近邻搜索的结果。
-
-    result.clear();
-    // 假设 candidates 已经按距离 query 升序排列 (search_layer_build 输出通常不是严格有序，需要注意)
-    // 但在 build 的 loop 中，我们通常会对 candidates 进行重排。
+    // 热点节点缓存: node -> 槽位 (-1 为未缓存)
+    vector<int> cache_slot;
+    huge_vector<char> cache_records;
 
-    // 这里做最简单的截断? 不，指南强调召回率。
-    // 我们需要重构逻辑：在build中，我们手动对candidates排序，然后做RobustPrune
+    unique_ptr<DiskReader> reader;
+    std::atomic<uint64_t> reads{0};
+    std::atomic<uint64_t> cache_hits{0};
+    std::atomic<uint64_t> io_errors{0};
 
-    // 这里的实现是一个简化的 RobustPrune，不重新计算距离，仅依赖输入顺序
-    // 这在 candidates 是 top-k 结果时有效。
-    // 为了更严谨，我们在 build 函数内部处理排序。
-    for (size_t i = 0; i < candidates.size() && result.size() < (size_t)k; ++i)
+    ~DiskIndex()
     {
-        int curr_id = candidates[i];
-        bool good = true;
+        if (fd >= 0)
+            close(fd);
+    }
+};
 
-        // 检查与已选节点的距离 (多样性)
-        for (int exist_id : result)
-        {
-            float dist_curr_exist = dist_l2_float_avx(
-                &data_flat[curr_id * dimension],
-                &data_flat[exist_id * dimension],
-                dimension);
+static thread_local vector<char> tls_disk_buf; // beam 读缓冲 (手动对齐到 DISK_BUF_ALIGN)
 
-            // 下面的距离是从外部传入的吗？不。
-            // 这里的 GAMMA 判定通常需要知道 curr 到 query 的距离。
-            // 由于缺乏 query 信息，我们退化为只选最近的 K 个（不使用 Gamma 剪枝），
-            // 或者这部分逻辑在 build 主循环实现更好。
+static char *disk_aligned_buf(size_t size)
+{
+    tls_disk_buf.resize(size + DISK_BUF_ALIGN);
+    return (char *)(((uintptr_t)tls_disk_buf.data() + DISK_BUF_ALIGN - 1) & ~(uintptr_t)(DISK_BUF_ALIGN - 1));
+}
 
-            // *决策*: 为了代码结构清晰，我们在 build 主循环中内联 RobustPrune 逻辑，
-            // 这里的函数仅作简单的 copy。
-        }
-        result.push_back(curr_id);
-    }
+// path 所在文件系统的 O_DIRECT 偏移对齐: 优先 statx(STATX_DIOALIGN)，否则取 st_blksize
+// (通常即逻辑块大小，4Kn 设备为 4096)；返回 0 表示不支持 O_DIRECT
+static size_t direct_io_alignment(const string &path)
+{
+#ifdef STATX_DIOALIGN
+    struct statx sx;
+    if (statx(AT_FDCWD, path.c_str(), 0, STATX_DIOALIGN, &sx) == 0 && (sx.stx_mask & STATX_DIOALIGN))
+        return sx.stx_dio_offset_align ? max(sx.stx_dio_offset_align, sx.stx_dio_mem_align) : 0;
+#endif
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && st.st_blksize > 0)
+        return st.st_blksize;
+    return DISK_BUF_ALIGN;
 }
 
-// 辅助：生成随机层级
-int Solution::get_random_level()
+static size_t disk_record_size(int dimension, int max_neighbors, size_t align)
 {
-    // 使用 hash<thread::id> 为每个线程生成唯一种子
-    static thread_local std::mt19937 rng(12345 + std::hash<std::thread::id>{}(std::this_thread::get_id()));
-    static thread_local std::uniform_real_distribution<float> dist(0.0, 1.0);
-    float r = dist(rng);
-    return (int)(-log(r) * ML);
+    align = max(align, DISK_ALIGN);
+    size_t raw = sizeof(int32_t) * (1 + max_neighbors) + sizeof(float) * dimension;
+    return (raw + align - 1) / align * align;
 }
 
-// --- 主构建流程 ---
-void Solution::build(int d, const vector<float> &base)
+// 由内存中的索引生成节点 id 的磁盘记录
+void Solution::encode_disk_record(int id, char *dst, size_t record_size, int max_neighbors) const
 {
-    dimension = d;
-    num_vectors = base.size() / d;
-    data_flat = base;
+    memset(dst, 0, record_size);
+    int32_t *header = reinterpret_cast<int32_t *>(dst);
+    int adj_buf[ADJ_DECODE_CAPACITY];
+    int count;
+    const int *nbs = layer0_neighbors(id, adj_buf, count);
+    count = min(count, max_neighbors);
+    header[0] = count;
+    memcpy(header + 1, nbs, count * sizeof(int32_t));
+    float *vec = reinterpret_cast<float *>(header + 1 + max_neighbors);
+    const float *v = get_vector(id, vec);
+    if (v != vec)
+        memcpy(vec, v, dimension * sizeof(float));
+}
 
-    // 参数初始化
-    M_max = M;
-    M_max0 = M * 2;
-    max_level = 0;
-    enter_point = 0;
+bool Solution::save_disk_index(const string &path) const
+{
+    // 磁盘记录只存一份向量，不支持投影索引
+    if (num_vectors == 0 || final_graph_offsets.empty() || !data_full.empty())
+        return false;
 
-    // 初始化节点
-    nodes.resize(num_vectors);
+    ofstream out(path, ios::binary | ios::trunc);
+    if (!out)
+        return false;
 
-    // Phase 3 优化: 预分配内存减少动态分配
-    // 预估每个节点的最大层级约为 log(N)/log(2) ~= 20 层
-    for (int i = 0; i < num_vectors; ++i)
+    // 记录按文件所在设备的 O_DIRECT 对齐补齐 (对齐过大则保持 DISK_ALIGN，打开时走缓冲读)
+    size_t align = direct_io_alignment(path);
+    DiskHeader header = {DISK_MAGIC, dimension, num_vectors, M_max0, 0, 0};
+    header.record_size = disk_record_size(dimension, M_max0, align <= DISK_HEADER_SIZE ? align : DISK_ALIGN);
+    vector<char> head(DISK_HEADER_SIZE, 0);
+    memcpy(head.data(), &header, sizeof(header));
+    out.write(head.data(), head.size());
+
+    // 分块编码后顺序写出
+    const int chunk = 4096;
+    vector<char> buf((size_t)chunk * header.record_size);
+    for (int begin = 0; begin < num_vectors; begin += chunk)
     {
-        nodes[i].neighbors.reserve(max(5, (int)(log(num_vectors) / log(2.0))));
+        int end = min(num_vectors, begin + chunk);
+        executor().parallel_for(begin, end, 256, [&](int i, int)
+        {
+            tls_decode_buf.resize(dimension);
+            encode_disk_record(i, &buf[(size_t)(i - begin) * header.record_size], header.record_size, M_max0);
+        });
+        out.write(buf.data(), (size_t)(end - begin) * header.record_size);
     }
+    return (bool)out;
+}
 
-    // 锁 (每个节点一把锁) - 使用 std::mutex 替代 omp_lock_t
-    vector<std::mutex> node_locks(num_vectors);
+bool Solution::open_disk_index(const string &path, int cache_nodes)
+{
+    if (num_vectors == 0 || final_graph_offsets.empty() || !data_full.empty())
+        return false;
+    // 释放 Layer 0 后高层下降只能走紧凑副本，须在 build 前选好 UPPER_COMPACT / UPPER_COMPACT_SQ8
+    if (upper_ids.empty())
+        return false;
 
-    // 第一个点
-    int level0 = get_random_level();
-    nodes[0].neighbors.resize(level0 + 1);
-    max_level = level0;
-    enter_point = 0;
+    auto disk_index = make_shared<DiskIndex>();
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    disk_index->fd = fd;
 
-// 并行构建
-#ifdef _OPENMP
-#pragma omp parallel
-#endif
-    {
-        // 线程局部随机数生成器在 get_random_level 中处理
-        // 访问缓存
-        tls_visited.prepare(num_vectors);
+    // 校验头 (缓冲读，O_DIRECT 在确认记录对齐后再启用)
+    char *aligned = disk_aligned_buf(DISK_HEADER_SIZE);
+    DiskHeader header;
+    if (!pread_full(fd, aligned, DISK_HEADER_SIZE, 0))
+        return false;
+    memcpy(&header, aligned, sizeof(header));
+    size_t raw_record = sizeof(int32_t) * (1 + header.max_neighbors) + sizeof(float) * dimension;
+    if (header.magic != DISK_MAGIC || header.dimension != dimension || header.num_vectors != num_vectors ||
+        header.max_neighbors <= 0 || header.record_size < raw_record || header.record_size % DISK_ALIGN != 0)
+        return false;
 
-#ifdef _OPENMP
-#pragma omp for schedule(dynamic, 128)
-#endif
-        for (int i = 1; i < num_vectors; ++i)
+    // 记录与头均满足设备的 O_DIRECT 对齐时才绕过页缓存 (如 512 B 记录在 4Kn 设备上会 EINVAL)
+    size_t align = direct_io_alignment(path);
+    if (align > 0 && align <= DISK_BUF_ALIGN && header.record_size % align == 0 && DISK_HEADER_SIZE % align == 0)
+    {
+        int direct_fd = open(path.c_str(), O_RDONLY | O_DIRECT);
+        if (direct_fd >= 0)
         {
-            const float *query = &data_flat[i * dimension];
-            int level = get_random_level();
-
-            // 临界区：更新最大层级
-            // 为性能考虑，不加锁读取，只有更新时加锁，或原子操作
-            // 这里简单处理，max_level 仅由主线程更新可能不安全，但 HNSW 允许这种 loose consistency
-            // 或者用 critical 更新 global max_level
-            int cur_max_level = max_level;
-            int curr_ep = enter_point;
+            close(fd);
+            disk_index->fd = direct_fd;
+            disk_index->direct_io = true;
+        }
+    }
+    disk_index->record_size = header.record_size;
+    disk_index->max_neighbors = header.max_neighbors;
 
-            // 1. 贪婪搜索找到当前层级的入口点
-            if (level < cur_max_level)
+    // 热点缓存: 从 enter_point 出发在 Layer 0 上 BFS
+    cache_nodes = max(0, min(cache_nodes, num_vectors));
+    disk_index->cache_slot.assign(num_vectors, -1);
+    disk_index->cache_records.resize((size_t)cache_nodes * header.record_size);
+    vector<int> order;
+    order.reserve(cache_nodes);
+    if (cache_nodes > 0)
+    {
+        order.push_back(enter_point);
+        disk_index->cache_slot[enter_point] = 0;
+    }
+    for (size_t head = 0; head < order.size() && (int)order.size() < cache_nodes; ++head)
+    {
+        int adj_buf[ADJ_DECODE_CAPACITY];
+        int count;
+        const int *nbs = layer0_neighbors(order[head], adj_buf, count);
+        for (int j = 0; j < count && (int)order.size() < cache_nodes; ++j)
+        {
+            int n = nbs[j];
+            if (disk_index->cache_slot[n] < 0)
             {
-                float min_dist = dist_l2_float_avx(query, &data_flat[curr_ep * dimension], dimension);
-                for (int lc = cur_max_level; lc > level; --lc)
-                {
-                    bool changed = true;
-                    while (changed)
-                    {
-                        changed = false;
-                        const vector<int> &nbs = nodes[curr_ep].neighbors[lc]; // 读操作，可能不安全？HNSW构建通常需要细粒度锁
-                        // 注意：这里读取 neighbors 时可能会有其他线程在写入。
-                        // 标准做法：加读锁，或者利用 vector 的各层独立性。
-                        // 在本指南的简单实现中，我们接受轻微的数据竞争带来的风险，或者在写入时 Copy-On-Write。
-                        // 实际上，为了严格正确性，应该锁住当前节点读取。
-                        // 但为了性能，大部分开源实现(如hnswlib)采用了乐观锁或细粒度锁。
-
-                        // 简单版本：只在连接时加锁。搜索时不加锁（可能读到旧数据）。
-                        for (int n : nbs)
-                        {
-                            float d = dist_l2_float_avx(query, &data_flat[n * dimension], dimension);
-                            if (d < min_dist)
-                            {
-                                min_dist = d;
-                                curr_ep = n;
-                                changed = true;
-                            }
-                        }
-                    }
-                }
+                disk_index->cache_slot[n] = (int)order.size();
+                order.push_back(n);
             }
+        }
+    }
+    executor().parallel_for(0, (int)order.size(), 256, [&](int s, int)
+    {
+        encode_disk_record(order[s], &disk_index->cache_records[(size_t)s * header.record_size],
+                           header.record_size, header.max_neighbors);
+    });
 
-            // 初始化当前节点
-            // 只有当前线程访问 nodes[i]，无需锁
-            nodes[i].neighbors.resize(level + 1);
-
-            // 2. 从 level 向下构建
-            // 需要在每层找到 ef_construction 个最近邻作为候选
-            vector<int> ep_container = {curr_ep};
-
-            for (int lc = min(level, cur_max_level); lc >= 0; --lc)
-            {
-                vector<int> candidates;
-                search_layer_build(query, candidates, ep_container, EF_CONSTRUCTION, lc);
-
-                // RobustPrune 选邻居逻辑
-                // 需要重新计算距离并排序
-                vector<pair<float, int>> sorted_cand;
-                for (int c : candidates)
-                {
-                    sorted_cand.push_back({dist_l2_float_avx(query, &data_flat[c * dimension], dimension), c});
-                }
-                sort(sorted_cand.begin(), sorted_cand.end());
-
-                // 选择邻居
-                vector<int> selected_neighbors;
-                int M_limit = (lc == 0) ? M_max0 : M_max;
+#ifdef USE_LIBURING
+    disk_index->reader.reset(new UringReader());
+#else
+    disk_index->reader.reset(new PreadPool(DISK_IO_THREADS));
+#endif
 
-                // Robust Prune Implementation inside loop
-                // Phase 4 优化: 限制候选池大小，只考虑前 2*M 个最近的候选点
-                int max_candidates = min((int)sorted_cand.size(), M_limit * 2);
-                for (int idx = 0; idx < max_candidates; ++idx)
-                {
-                    if (selected_neighbors.size() >= (size_t)M_limit)
-                        break;
-                    const auto &pair = sorted_cand[idx];
-                    int cand_id = pair.second;
-                    float dist_to_q = pair.first;
+    // 高层下降已走紧凑副本，释放全精度向量与 Layer 0
+    huge_vector<float>().swap(data_flat);
+    huge_vector<uint16_t>().swap(data_half);
+    huge_vector<int>().swap(final_graph_flat);
+    huge_vector<uint8_t>().swap(graph_packed);
+    huge_vector<size_t>().swap(final_graph_offsets);
+    huge_vector<uint8_t>().swap(pq4_blocks);
+    huge_vector<size_t>().swap(pq4_block_offsets);
+    for (int i = 0; i < num_vectors; ++i)
+    {
+        if (!nodes[i].neighbors.empty())
+            vector<int>().swap(nodes[i].neighbors[0]);
+    }
+    disable_numa_replicas();
+    clear_result_cache();
 
-                    bool good = true;
-                    for (int exist_id : selected_neighbors)
-                    {
-                        float dist_exist = dist_l2_float_avx(
-                            &data_flat[cand_id * dimension],
-                            &data_flat[exist_id * dimension],
-                            dimension);
-                        if (dist_exist * GAMMA < dist_to_q)
-                        {
-                            good = false;
-                            break;
-                        }
-                    }
-                    if (good)
-                        selected_neighbors.push_back(cand_id);
-                }
+    disk = disk_index;
+    return true;
+}
 
-                // 双向连接
-                // 1. 将 selected 连接到 i
-                nodes[i].neighbors[lc] = selected_neighbors;
+Solution::DiskIndexStats Solution::disk_index_stats() const
+{
+    DiskIndexStats stats = {0, 0, 0, false};
+    if (!disk)
+        return stats;
+    stats.reads = disk->reads.load(std::memory_order_relaxed);
+    stats.cache_hits = disk->cache_hits.load(std::memory_order_relaxed);
+    stats.io_errors = disk->io_errors.load(std::memory_order_relaxed);
+    stats.direct_io = disk->direct_io;
+    return stats;
+}
 
-                // 2. 将 i 连接到 selected 中的每个节点 (需要加锁)
-                // Phase 2 优化: 减少锁内工作量
-                for (int neighbor_id : selected_neighbors)
-                {
-                    std::lock_guard<std::mutex> lock(node_locks[neighbor_id]);
-                    vector<int> &target_neighbors = nodes[neighbor_id].neighbors[lc];
+// Beam search: 候选列表按 SQ8 距离排序，每轮取最近的 DISK_BEAM_WIDTH 个未展开节点，
+// 一次批量读取其记录；记录中的全精度向量给出精确距离，邻居用内存中的 SQ8 码估计。
+// 最终按已展开节点的精确距离取 top-10；读盘失败时结果填 -1 / +inf 并返回 false。
+bool Solution::search_disk(const float *query, const unsigned char *query_quant, int *res, float *dists) const
+{
+    DiskIndex &di = *disk;
+    const int L = query_ef();
+    const size_t rs = di.record_size;
 
-                    // 快速路径: 如果未满，直接插入
-                    if (target_neighbors.size() < (size_t)M_limit)
-                    {
-                        target_neighbors.push_back(i);
-                    }
-                    else
-                    {
-                        // 慢速路径: 需要剪枝
-                        // 使用简化策略: 计算距离后保留最近的 M_limit 个
-                        // 这比完整的 RobustPrune 快很多，同时在反向连接时影响较小
-                        vector<pair<float, int>> t_cand;
-                        t_cand.reserve(target_neighbors.size() + 1);
+    tls_visited.prepare(num_vectors);
+    struct BeamCandidate
+    {
+        float dist;
+        int id;
+        bool expanded;
+    };
+    vector<BeamCandidate> list;
+    list.reserve(L + 1);
+    auto insert = [&](int id, float d)
+    {
+        if ((int)list.size() >= L && d >= list.back().dist)
+            return;
+        auto pos = upper_bound(list.begin(), list.end(), d,
+                               [](float v, const BeamCandidate &c) { return v < c.dist; });
+        list.insert(pos, {d, id, false});
+        if ((int)list.size() > L)
+            list.pop_back();
+    };
 
-                        const float *target_vec = &data_flat[neighbor_id * dimension];
+    vector<int> eps;
+    select_entry_points(query, eps);
+    for (int ep : eps)
+    {
+        tls_visited.mark(ep);
+        insert(ep, dist_l2_quant(ep, query_quant, dimension));
+    }
 
-                        // 计算所有现有邻居的距离
-                        for (int tn : target_neighbors)
-                        {
-                            t_cand.push_back({dist_l2_float_avx(target_vec, &data_flat[tn * dimension], dimension), tn});
-                        }
-                        // 添加新节点
-                        t_cand.push_back({dist_l2_float_avx(target_vec, &data_flat[i * dimension], dimension), i});
-
-                        // 部分排序: 只需要找到最小的 M_limit 个
-                        std::partial_sort(t_cand.begin(),
-                                          t_cand.begin() + M_limit,
-                                          t_cand.end());
-
-                        // 保留最近的 M_limit 个
-                        target_neighbors.clear();
-                        target_neighbors.reserve(M_limit);
-                        for (int j = 0; j < M_limit; ++j)
-                        {
-                            target_neighbors.push_back(t_cand[j].second);
-                        }
-                    }
-                }
+    char *io_buf = disk_aligned_buf(DISK_BEAM_WIDTH * rs);
+    vector<pair<float, int>> exact;
+    vector<int> beam;
+    const char *records[DISK_BEAM_WIDTH];
+    vector<DiskRead> reqs;
 
-                ep_container = selected_neighbors; // 下一层的入口
+    while (true)
+    {
+        // 1. 取 beam
+        beam.clear();
+        for (auto &c : list)
+        {
+            if (!c.expanded)
+            {
+                c.expanded = true;
+                beam.push_back(c.id);
+                if ((int)beam.size() == DISK_BEAM_WIDTH)
+                    break;
             }
+        }
+        if (beam.empty())
+            break;
 
-            // 更新全局入口点 (如果是更高层)
-            if (level > max_level)
+        // 2. 缓存命中直接引用，其余批量读取
+        reqs.clear();
+        for (size_t b = 0; b < beam.size(); ++b)
+        {
+            int slot = di.cache_slot[beam[b]];
+            if (slot >= 0)
             {
-#ifdef _OPENMP
-#pragma omp critical
-#endif
+                records[b] = &di.cache_records[(size_t)slot * rs];
+                continue;
+            }
+            char *buf = io_buf + reqs.size() * rs;
+            records[b] = buf;
+            reqs.push_back({buf, rs, (off_t)(DISK_HEADER_SIZE + (size_t)beam[b] * rs)});
+        }
+        di.cache_hits.fetch_add(beam.size() - reqs.size(), std::memory_order_relaxed);
+        if (!reqs.empty())
+        {
+            di.reads.fetch_add(reqs.size(), std::memory_order_relaxed);
+            if (!di.reader->read_batch(di.fd, reqs))
+            {
+                // 部分 beam 缺失时的 top-10 不可信，整体作废
+                di.io_errors.fetch_add(1, std::memory_order_relaxed);
+                for (int i = 0; i < TOP_K; ++i)
                 {
-                    if (level > max_level)
-                    {
-                        max_level = level;
-                        enter_point = i;
-                    }
+                    res[i] = -1;
+                    if (dists)
+                        dists[i] = numeric_limits<float>::infinity();
                 }
+                return false;
+            }
+        }
+
+        // 3. 精确距离 + 邻居入列
+        for (size_t b = 0; b < beam.size(); ++b)
+        {
+            const int32_t *header = reinterpret_cast<const int32_t *>(records[b]);
+            const float *vec = reinterpret_cast<const float *>(header + 1 + di.max_neighbors);
+            exact.push_back({dist_l2_float_avx(query, vec, dimension), beam[b]});
+
+            int count = header[0];
+            for (int j = 0; j < count; ++j)
+            {
+                int n = header[1 + j];
+                if (tls_visited.is_visited(n))
+                    continue;
+                tls_visited.mark(n);
+                insert(n, dist_l2_quant(n, query_quant, dimension));
             }
         }
     }
 
-    // 构建后优化：Layer 0 扁平化
-    flatten_layer0();
+    size_t top = min<size_t>(TOP_K, exact.size());
+    partial_sort(exact.begin(), exact.begin() + top, exact.end());
+    for (int i = 0; i < TOP_K; ++i)
+    {
+        const auto &r = exact.empty() ? make_pair(0.0f, 0) : exact[min<size_t>(i, top - 1)];
+        res[i] = r.second;
+        if (dists)
+            dists[i] = r.first;
+    }
+    return true;
+}
 
-    // 构建后优化：标量量化 (SQ)
-    init_quantization();
+// =========================================================
+// 分片索引 (ShardedSolution)
+// =========================================================
+
+// 分片参数
+static const int SHARD_KMEANS_SAMPLE = 256; // k-means 划分时每个分片的采样点数
+static const int SHARD_KMEANS_ITERS = 12;
+static const unsigned SHARD_SEED = 4242;
+
+ShardedSolution::ShardedSolution(int num_shards, const Solution &prototype)
+{
+    num_shards = max(1, num_shards);
+    shards.assign(num_shards, prototype);
+    for (Solution &shard : shards)
+        shard.detach_shared_state();
 }
 
-void Solution::flatten_layer0()
+void ShardedSolution::build(int d, const vector<float> &base)
 {
-    // 计算扁平化所需空间
-    size_t total_size = 0;
-    final_graph_offsets.resize(num_vectors);
+    dimension = d;
+    const int n = base.size() / d;
+    const int num_shards = (int)shards.size();
 
-    for (int i = 0; i < num_vectors; ++i)
+    // 1. 划分
+    vector<int> shard_of(n);
+    vector<float>().swap(centroids);
+    if (partition == PARTITION_KMEANS && num_shards > 1 && n > num_shards)
     {
-        final_graph_offsets[i] = total_size;
-        // 格式: [count, n1, n2, ...]
-        if (nodes[i].neighbors.size() > 0)
+        int sample_size = min(n, num_shards * SHARD_KMEANS_SAMPLE);
+        std::mt19937 rng(SHARD_SEED);
+        vector<float> sample((size_t)sample_size * d);
+        for (int i = 0; i < sample_size; ++i)
         {
-            total_size += 1 + nodes[i].neighbors[0].size();
+            std::uniform_int_distribution<int> pick(0, n - 1);
+            memcpy(&sample[(size_t)i * d], &base[(size_t)pick(rng) * d], d * sizeof(float));
         }
-        else
+        Solution::train_kmeans(sample.data(), sample_size, d, num_shards, SHARD_KMEANS_ITERS, SHARD_SEED,
+                               centroids, &executor());
+        executor().parallel_for(0, n, 1024, [&](int i, int)
         {
-            total_size += 1; // count = 0
-        }
+            shard_of[i] = Solution::nearest_centroid(&base[(size_t)i * d], centroids.data(), num_shards, d);
+        });
+    }
+    else
+    {
+        for (int i = 0; i < n; ++i)
+            shard_of[i] = i % num_shards;
     }
 
-    final_graph_flat.resize(total_size);
+    local_to_global.assign(num_shards, vector<int>());
+    for (int i = 0; i < n; ++i)
+        local_to_global[shard_of[i]].push_back(i);
 
-// 填充数据
-#ifdef _OPENMP
-#pragma omp parallel for
-#endif
-    for (int i = 0; i < num_vectors; ++i)
+    // 2. 构建: 分片数不少于执行器线程数时按分片并行 (分片内部的嵌套调用串行)，否则逐个分片使用全部线程
+    auto build_shard = [&](int s)
     {
-        size_t offset = final_graph_offsets[i];
-        if (nodes[i].neighbors.size() > 0)
-        {
-            const vector<int> &nbs = nodes[i].neighbors[0];
-            final_graph_flat[offset] = (int)nbs.size();
-            memcpy(&final_graph_flat[offset + 1], nbs.data(), nbs.size() * sizeof(int));
+        const vector<int> &ids = local_to_global[s];
+        if (ids.empty())
+            return;
+        vector<float> shard_base((size_t)ids.size() * d);
+        for (size_t j = 0; j < ids.size(); ++j)
+            memcpy(&shard_base[j * d], &base[(size_t)ids[j] * d], d * sizeof(float));
+        shards[s].build(d, shard_base);
+    };
+    Executor &exec = executor();
+    if (num_shards >= exec.concurrency())
+    {
+        exec.parallel_for(0, num_shards, 1, [&](int s, int) { build_shard(s); });
+    }
+    else
+    {
+        for (int s = 0; s < num_shards; ++s)
+            build_shard(s);
+    }
+}
 
-            // 释放内存：Layer 0 数据已转移，清空原 vector
-            // vector<int>().swap(nodes[i].neighbors[0]);
-            // 注意：不要在这里释放，因为 high layer search 可能偶尔需要用到？
-            // 不，high layer search 只涉及 lc > 0。
-            // 实际上，为了内存，我们可以清空 nodes[i].neighbors[0]
-            // 但 nodes 是 vector<vector<int>>，清空第0个元素只是变为空 vector
-        }
-        else
+// 分片共享原型的执行器 (拷贝得到同一个 custom_executor)
+Executor &ShardedSolution::executor() const
+{
+    return shards[0].executor();
+}
+
+// 选出需要查询的分片: 未使用 k-means 划分或 probe 为 0 时为全部分片
+void ShardedSolution::route(const float *query, vector<int> &targets) const
+{
+    const int num_shards = (int)shards.size();
+    targets.clear();
+    if (centroids.empty() || probe_shards <= 0 || probe_shards >= num_shards)
+    {
+        for (int s = 0; s < num_shards; ++s)
+            targets.push_back(s);
+        return;
+    }
+
+    vector<pair<float, int>> order(num_shards);
+    for (int s = 0; s < num_shards; ++s)
+        order[s] = {Solution::dist_l2_float_avx(query, &centroids[(size_t)s * dimension], dimension), s};
+    partial_sort(order.begin(), order.begin() + probe_shards, order.end());
+    for (int i = 0; i < probe_shards; ++i)
+        targets.push_back(order[i].second);
+}
+
+void ShardedSolution::search(const vector<float> &query, int *res)
+{
+    search_shards(query, res, true);
+}
+
+// scatter: 各分片独立搜索 (带精确距离)；gather: 按距离归并为全局 top-10
+// fan_out 时经执行器并行访问各分片，否则在调用线程上逐个分片
+void ShardedSolution::search_shards(const vector<float> &query, int *res, bool fan_out)
+{
+    vector<int> targets;
+    route(query.data(), targets);
+    const int count = (int)targets.size();
+
+    vector<int> ids((size_t)count * 10, -1);
+    vector<float> dists((size_t)count * 10, std::numeric_limits<float>::max());
+    auto search_shard = [&](int t)
+    {
+        int s = targets[t];
+        if (local_to_global[s].empty())
+            return;
+        shards[s].search_with_distances(query, &ids[(size_t)t * 10], &dists[(size_t)t * 10]);
+    };
+    if (fan_out && count > 1)
+    {
+        executor().parallel_for(0, count, 1, [&](int t, int) { search_shard(t); });
+    }
+    else
+    {
+        for (int t = 0; t < count; ++t)
+            search_shard(t);
+    }
+
+    vector<pair<float, int>> merged;
+    merged.reserve((size_t)count * 10);
+    for (int t = 0; t < count; ++t)
+    {
+        const vector<int> &l2g = local_to_global[targets[t]];
+        for (int j = 0; j < 10; ++j)
         {
-            final_graph_flat[offset] = 0;
+            int local = ids[(size_t)t * 10 + j];
+            if (local < 0 || local >= (int)l2g.size())
+                continue;
+            int global = l2g[local];
+            // 分片结果不足 10 个时会补位重复 id
+            bool duplicate = false;
+            for (const auto &m : merged)
+                duplicate = duplicate || m.second == global;
+            if (!duplicate)
+                merged.push_back({dists[(size_t)t * 10 + j], global});
         }
     }
+    size_t top = min<size_t>(10, merged.size());
+    partial_sort(merged.begin(), merged.begin() + top, merged.end());
+    for (int i = 0; i < 10; ++i)
+        res[i] = merged.empty() ? 0 : merged[min<size_t>(i, top - 1)].second;
 }
 
-// --- 搜索接口 ---
-void Solution::search(const vector<float> &query, int *res)
+// 查询数不少于执行器线程数时按查询并行 (查询内逐个分片)，否则逐个查询并行访问分片
+void ShardedSolution::search_batch(const vector<vector<float>> &queries, int *res)
 {
-    if (num_vectors == 0)
-        return;
+    const int num_queries = (int)queries.size();
+    Executor &exec = executor();
+    if (num_queries >= exec.concurrency())
+    {
+        exec.parallel_for(0, num_queries, 16, [&](int q, int)
+        {
+            search_shards(queries[q], res + (size_t)q * 10, false);
+        });
+    }
+    else
+    {
+        for (int q = 0; q < num_queries; ++q)
+            search_shards(queries[q], res + (size_t)q * 10, true);
+    }
+}
 
-    // 1. 量化查询向量 (用于Layer 0)
-    tls_quant_query_buf.resize(dimension);
-    unsigned char *q_quant_ptr = tls_quant_query_buf.data();
-    quantize_vec(query.data(), q_quant_ptr);
+// =========================================================
+// IVF 倒排索引 (IvfSolution)
+// =========================================================
 
-    int curr_ep = enter_point;
-    vector<int> ep_container = {curr_ep};
+// IVF 参数
+static const int IVF_KMEANS_SAMPLE_PER_LIST = 64; // k-means 每个表的采样点数
+static const int IVF_KMEANS_ITERS = 10;
+static const unsigned IVF_SEED = 1357;
+static const int IVF_QUERY_GROUP = 8; // 批量扫描时同时处理的查询数 (共享一块向量)
+static const int IVF_SCAN_TILE = 64;  // 批量扫描的向量块大小
 
-    // 2. 高层导航 (Layer max ~ 1) - 使用精确距离 (Float + AVX)
-    // 优化方案D建议：高层ef可设为1或稍大。为了召回率，保持 ef=1 足够，
-    // 但如果在 layer 1 附近，可以稍微增大搜索范围。
-    // 基准代码通常 ef=1。
+// 固定容量的 top-10 (升序插入)
+struct IvfTopK
+{
+    float dist[TOP_K];
+    int id[TOP_K];
+    int size = 0;
+    float bound = std::numeric_limits<float>::max(); // 外部已知的第 10 近距离上界 (批量扫描时跨表共享)
 
-    for (int lc = max_level; lc > 0; --lc)
+    float worst() const { return size < TOP_K ? bound : min(bound, dist[TOP_K - 1]); }
+
+    void push(float d, int v)
     {
-        // 在高层我们不做复杂的搜索，只做贪婪下降
-        // 但复用 search_layer_query 也可以，只要 ef=1
-        // 为了极致速度，手写简单贪婪遍历
-        bool changed = true;
-        while (changed)
+        if (d >= worst())
+            return;
+        int pos = size < TOP_K ? size++ : TOP_K - 1;
+        while (pos > 0 && dist[pos - 1] > d)
         {
-            changed = false;
-            float dist = dist_l2_float_avx(query.data(), &data_flat[curr_ep * dimension], dimension);
-            const vector<int> &nbs = nodes[curr_ep].neighbors[lc];
-
-            for (int n : nbs)
-            {
-                float d = dist_l2_float_avx(query.data(), &data_flat[n * dimension], dimension);
-                if (d < dist)
-                {
-                    dist = d;
-                    curr_ep = n;
-                    changed = true;
-                }
-            }
+            dist[pos] = dist[pos - 1];
+            id[pos] = id[pos - 1];
+            pos--;
         }
+        dist[pos] = d;
+        id[pos] = v;
     }
-    ep_container[0] = curr_ep;
 
-    // 3. 底层搜索 (Layer 0) - 使用量化距离 (SQ + Flattened Graph)
-    vector<int> candidates;
-    search_layer_query(query.data(), q_quant_ptr, candidates, ep_container, EF_SEARCH, 0);
+    // 写出结果 (不足 10 个时用第一个补位，与 rerank_topk 一致)
+    void write(int *res) const
+    {
+        for (int i = 0; i < TOP_K; ++i)
+            res[i] = i < size ? id[i] : (size > 0 ? id[0] : 0);
+    }
+};
 
-    // ---------------------------------------------------------
-    // 【关键修复】重排序 (Re-ranking) - 使用精确浮点距离
-    // ---------------------------------------------------------
-    // Layer 0 搜索使用量化距离，快但有误差
-    // 必须用精确距离重新排序，才能保证召回率
+// 按维 SQ8 的加权非对称距离: sum w_j * (q_j - c_j)^2，q 已变换到码字尺度，w_j = step_j^2
+static inline float dist_sq8_weighted(const float *q, const float *w, const uint8_t *codes, int d)
+{
+    int i = 0;
+    float total = 0.0f;
+#if defined(__AVX2__)
+    __m256 sum = _mm256_setzero_ps();
+    for (; i + 8 <= d; i += 8)
+    {
+        __m256i c = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(codes + i)));
+        __m256 diff = _mm256_sub_ps(_mm256_loadu_ps(q + i), _mm256_cvtepi32_ps(c));
+        sum = _mm256_fmadd_ps(_mm256_mul_ps(diff, diff), _mm256_loadu_ps(w + i), sum);
+    }
+    float res[8];
+    _mm256_storeu_ps(res, sum);
+    total = res[0] + res[1] + res[2] + res[3] + res[4] + res[5] + res[6] + res[7];
+#endif
+    for (; i < d; ++i)
+    {
+        float diff = q[i] - (float)codes[i];
+        total += w[i] * diff * diff;
+    }
+    return total;
+}
 
-    tls_candidate_queue.clear();
+void IvfSolution::build(int d, const vector<float> &base)
+{
+    dimension = d;
+    num_vectors = base.size() / d;
+    const int n = num_vectors;
+    nlist = num_lists_cfg > 0 ? num_lists_cfg : max(1, (int)(4 * sqrt((double)n)));
+    nlist = max(1, min(nlist, n));
 
-    for (int cand_id : candidates)
+    // 1. 粗量化器
+    int sample_size = min(n, nlist * IVF_KMEANS_SAMPLE_PER_LIST);
+    std::mt19937 rng(IVF_SEED);
+    vector<float> sample((size_t)sample_size * d);
+    for (int i = 0; i < sample_size; ++i)
     {
-        // 使用 AVX 精确浮点距离重新计算
-        float exact_dist = dist_l2_float_avx(query.data(), &data_flat[cand_id * dimension], dimension);
-        tls_candidate_queue.push_back({exact_dist, cand_id});
+        std::uniform_int_distribution<int> pick(0, n - 1);
+        int src = sample_size == n ? i : pick(rng);
+        memcpy(&sample[(size_t)i * d], &base[(size_t)src * d], d * sizeof(float));
     }
+    if (n > 0)
+        Solution::train_kmeans(sample.data(), sample_size, d, nlist, IVF_KMEANS_ITERS, IVF_SEED, centroids,
+                               &executor());
+    vector<float>().swap(sample);
 
-    // 排序：按距离从小到大
-    // 只需要 Top 10，使用 partial_sort 比 sort 更快
-    if (tls_candidate_queue.size() > 10)
+    // 2. 分配并按表连续排列 (计数排序)
+    vector<int> list_of(n);
+    executor().parallel_for(0, n, 1024, [&](int i, int)
     {
-        std::partial_sort(tls_candidate_queue.begin(),
-                          tls_candidate_queue.begin() + 10,
-                          tls_candidate_queue.end());
-    }
-    else
+        list_of[i] = Solution::nearest_centroid(&base[(size_t)i * d], centroids.data(), nlist, d);
+    });
+    list_offsets.assign(nlist + 1, 0);
+    for (int i = 0; i < n; ++i)
+        list_offsets[list_of[i] + 1]++;
+    for (int l = 0; l < nlist; ++l)
+        list_offsets[l + 1] += list_offsets[l];
+    list_ids.resize(n);
     {
-        std::sort(tls_candidate_queue.begin(), tls_candidate_queue.end());
+        vector<size_t> fill_pos(list_offsets.begin(), list_offsets.end() - 1);
+        for (int i = 0; i < n; ++i)
+            list_ids[fill_pos[list_of[i]]++] = i;
     }
 
-    // 4. 填充结果
-    for (int i = 0; i < 10 && i < (int)tls_candidate_queue.size(); ++i)
+    // 3. 表内向量
+    huge_vector<float>().swap(list_vectors);
+    huge_vector<uint8_t>().swap(list_codes);
+    if (!use_sq8)
     {
-        res[i] = tls_candidate_queue[i].second;
+        list_vectors.resize((size_t)n * d);
+        executor().parallel_for(0, n, 1024, [&](int j, int)
+        {
+            memcpy(&list_vectors[(size_t)j * d], &base[(size_t)list_ids[j] * d], d * sizeof(float));
+        });
+        return;
     }
-    // 补位
-    for (int i = tls_candidate_queue.size(); i < 10; ++i)
+    sq_min.assign(d, std::numeric_limits<float>::max());
+    vector<float> sq_max(d, std::numeric_limits<float>::lowest());
+    for (int i = 0; i < n; ++i)
     {
-        res[i] = tls_candidate_queue.empty() ? 0 : tls_candidate_queue[0].second;
+        for (int j = 0; j < d; ++j)
+        {
+            sq_min[j] = min(sq_min[j], base[(size_t)i * d + j]);
+            sq_max[j] = max(sq_max[j], base[(size_t)i * d + j]);
+        }
+    }
+    sq_step.resize(d);
+    sq_weight.resize(d);
+    for (int j = 0; j < d; ++j)
+    {
+        sq_step[j] = sq_max[j] > sq_min[j] ? (sq_max[j] - sq_min[j]) / 255.0f : 1.0f;
+        sq_weight[j] = sq_step[j] * sq_step[j];
     }
+    list_codes.resize((size_t)n * d);
+    executor().parallel_for(0, n, 1024, [&](int j, int)
+    {
+        const float *v = &base[(size_t)list_ids[j] * d];
+        uint8_t *dst = &list_codes[(size_t)j * d];
+        for (int t = 0; t < d; ++t)
+        {
+            int q = (int)((v[t] - sq_min[t]) / sq_step[t] + 0.5f);
+            dst[t] = (uint8_t)min(255, max(0, q));
+        }
+    });
 }
 
-// [调试功能] 暴力搜索 - 用于验证HNSW结果的正确性
-#ifdef DEBUG_BRUTE_FORCE
-void Solution::search_brute_force(const vector<float> &query, int *res) const
+Executor &IvfSolution::executor() const
 {
-    if (num_vectors == 0)
-        return;
+    return custom_executor ? *custom_executor : default_executor();
+}
 
-    // 计算所有点的距离
-    vector<pair<float, int>> all_dists;
-    all_dists.reserve(num_vectors);
+// 最近的 nprobe 个表 (order 为复用的临时缓冲)
+void IvfSolution::probe_lists(const float *query, vector<pair<float, int>> &order, int *lists) const
+{
+    const int np = min(nprobe, nlist);
+    order.resize(nlist);
+    for (int l = 0; l < nlist; ++l)
+        order[l] = {Solution::dist_l2_float_avx(query, &centroids[(size_t)l * dimension], dimension), l};
+    partial_sort(order.begin(), order.begin() + np, order.end());
+    for (int p = 0; p < np; ++p)
+        lists[p] = order[p].second;
+}
 
-    for (int i = 0; i < num_vectors; ++i)
+// 扫描用查询: FP32 模式为原查询，SQ8 模式变换到码字尺度 (prepared 需 dimension 个元素)
+void IvfSolution::prepare_query(const float *query, float *prepared) const
+{
+    for (int j = 0; j < dimension; ++j)
+        prepared[j] = use_sq8 ? (query[j] - sq_min[j]) / sq_step[j] : query[j];
+}
+
+// 扫描一个表: 按 IVF_SCAN_TILE 分块，块内向量依次与 nq 个查询计算距离 (块留在 L1 中被复用)
+void IvfSolution::scan_list(int list, const float *const *prepared, int nq, IvfTopK *heaps) const
+{
+    const size_t begin = list_offsets[list], end = list_offsets[list + 1];
+    for (size_t tile = begin; tile < end; tile += IVF_SCAN_TILE)
     {
-        float d = dist_l2_float_avx(query.data(), &data_flat[i * dimension], dimension);
-        all_dists.push_back({d, i});
+        const size_t tile_end = min(end, tile + IVF_SCAN_TILE);
+        for (int q = 0; q < nq; ++q)
+        {
+            IvfTopK &top = heaps[q];
+            for (size_t j = tile; j < tile_end; ++j)
+            {
+                float dist;
+                if (use_sq8)
+                {
+                    dist = dist_sq8_weighted(prepared[q], sq_weight.data(), &list_codes[j * dimension], dimension);
+                }
+                else
+                {
+                    const float *v = &list_vectors[j * dimension];
+                    dist = dist_l2_bounded(
+                        prepared[q], dimension, top.worst(),
+                        [v](int t)
+                        {
+#if defined(__AVX2__)
+                            return _mm256_loadu_ps(v + t);
+#else
+                            return 0;
+#endif
+                        },
+                        [v](int t) { return v[t]; });
+                }
+                top.push(dist, list_ids[j]);
+            }
+        }
     }
+}
+
+void IvfSolution::search(const vector<float> &query, int *res) const
+{
+    if (num_vectors == 0)
+        return;
+    const int np = min(nprobe, nlist);
+    vector<pair<float, int>> order;
+    vector<int> lists(np);
+    probe_lists(query.data(), order, lists.data());
+
+    vector<float> prepared(dimension);
+    prepare_query(query.data(), prepared.data());
+    const float *q = prepared.data();
+    IvfTopK top;
+    for (int p = 0; p < np; ++p)
+        scan_list(lists[p], &q, 1, &top);
+    top.write(res);
+}
+
+void IvfSolution::search_batch(const vector<vector<float>> &queries, int *res) const
+{
+    const int nq = (int)queries.size();
+    if (nq == 0 || num_vectors == 0)
+        return;
+    const int np = min(nprobe, nlist);
 
-    // 排序
-    sort(all_dists.begin(), all_dists.end());
+    // 1. 选表并预处理查询
+    vector<int> probes((size_t)nq * np);
+    vector<float> prepared((size_t)nq * dimension);
+    Executor &exec = executor();
+    vector<vector<pair<float, int>>> orders(max(1, exec.concurrency())); // 每个执行线程的临时缓冲
+    exec.parallel_for(0, nq, 16, [&](int q, int worker)
+    {
+        probe_lists(queries[q].data(), orders[worker], &probes[(size_t)q * np]);
+        prepare_query(queries[q].data(), &prepared[(size_t)q * dimension]);
+    });
 
-    // 取前10个
-    for (int i = 0; i < 10 && i < (int)all_dists.size(); ++i)
+    // 2. 按表分组: list -> (查询, 探测序号)
+    vector<size_t> group_offsets(nlist + 1, 0);
+    for (int x : probes)
+        group_offsets[x + 1]++;
+    for (int l = 0; l < nlist; ++l)
+        group_offsets[l + 1] += group_offsets[l];
+    vector<int> group_slots(probes.size()); // q * np + p
     {
-        res[i] = all_dists[i].second;
+        vector<size_t> fill_pos(group_offsets.begin(), group_offsets.end() - 1);
+        for (size_t s = 0; s < probes.size(); ++s)
+            group_slots[fill_pos[probes[s]]++] = (int)s;
     }
-    for (int i = all_dists.size(); i < 10; ++i)
+
+    // 3. 逐表扫描 (开销大的表先调度)，结果写入各 (查询, 探测序号) 的部分 top-10。
+    //    每个查询的当前第 10 近距离跨表共享，作为后续表的剪枝上界 (提前终止)
+    vector<int> list_order;
+    for (int l = 0; l < nlist; ++l)
     {
-        res[i] = all_dists.empty() ? 0 : all_dists[0].second;
+        if (group_offsets[l + 1] > group_offsets[l])
+            list_order.push_back(l);
     }
+    sort(list_order.begin(), list_order.end(), [&](int a, int b)
+         { return (list_offsets[a + 1] - list_offsets[a]) * (group_offsets[a + 1] - group_offsets[a]) >
+                  (list_offsets[b + 1] - list_offsets[b]) * (group_offsets[b + 1] - group_offsets[b]); });
+    vector<IvfTopK> partial(probes.size());
+    vector<std::atomic<float>> query_bound(nq);
+    for (auto &b : query_bound)
+        b.store(std::numeric_limits<float>::max(), std::memory_order_relaxed);
+    exec.parallel_for(0, (int)list_order.size(), 1, [&](int t, int)
+    {
+        const int l = list_order[t];
+        const float *q_ptrs[IVF_QUERY_GROUP];
+        IvfTopK heaps[IVF_QUERY_GROUP];
+        for (size_t g = group_offsets[l]; g < group_offsets[l + 1]; g += IVF_QUERY_GROUP)
+        {
+            const int count = (int)min((size_t)IVF_QUERY_GROUP, group_offsets[l + 1] - g);
+            for (int k = 0; k < count; ++k)
+            {
+                const int q = group_slots[g + k] / np;
+                q_ptrs[k] = &prepared[(size_t)q * dimension];
+                heaps[k] = IvfTopK();
+                heaps[k].bound = query_bound[q].load(std::memory_order_relaxed);
+            }
+            scan_list(l, q_ptrs, count, heaps);
+            for (int k = 0; k < count; ++k)
+            {
+                partial[group_slots[g + k]] = heaps[k];
+                if (heaps[k].size < TOP_K)
+                    continue;
+                std::atomic<float> &b = query_bound[group_slots[g + k] / np];
+                float cur = b.load(std::memory_order_relaxed);
+                while (heaps[k].dist[TOP_K - 1] < cur &&
+                       !b.compare_exchange_weak(cur, heaps[k].dist[TOP_K - 1], std::memory_order_relaxed))
+                {
+                }
+            }
+        }
+    });
+
+    // 4. 合并各表的部分结果
+    exec.parallel_for(0, nq, 64, [&](int q, int)
+    {
+        IvfTopK top;
+        for (int p = 0; p < np; ++p)
+        {
+            const IvfTopK &part = partial[(size_t)q * np + p];
+            for (int i = 0; i < part.size; ++i)
+                top.push(part.dist[i], part.id[i]);
+        }
+        top.write(res + (size_t)q * 10);
+    });
 }
-#endif
\ No newline at end of file
@@ -6,28 +6,325 @@
 #include <cmath>
 #include <mutex>
 #include <cstring>
+#include <cstdint>
 #include <queue>        // priority_queue 支持
 #include <functional>   // greater<T> 支持
 #include <utility>      // pair 支持
+#include <memory>       // shared_ptr 支持
+#include <string>
 
 using namespace std;
 
+// --- 大页分配器 (大块走 mmap + 大页，小块走 operator new) ---
+void* huge_page_alloc(size_t bytes);
+void huge_page_free(void* p, size_t bytes);
+
+template <class T>
+struct HugePageAllocator {
+    typedef T value_type;
+    HugePageAllocator() noexcept {}
+    template <class U> HugePageAllocator(const HugePageAllocator<U>&) noexcept {}
+    T* allocate(size_t n) { return static_cast<T*>(huge_page_alloc(n * sizeof(T))); }
+    void deallocate(T* p, size_t n) noexcept { huge_page_free(p, n * sizeof(T)); }
+};
+template <class T, class U>
+bool operator==(const HugePageAllocator<T>&, const HugePageAllocator<U>&) { return true; }
+template <class T, class U>
+bool operator!=(const HugePageAllocator<T>&, const HugePageAllocator<U>&) { return false; }
+
+template <class T>
+using huge_vector = vector<T, HugePageAllocator<T>>;
+
+// --- 可插拔执行器 (构建与批量查询的并行循环) ---
+// parallel_for 对 [begin, end) 中每个 i 调用 body(i, worker) 一次，返回时全部完成；
+// worker 为 [0, concurrency()) 内的执行线程编号，可用于索引线程私有的累加器。
+// 宿主程序可实现此接口接入自己的线程池。
+class Executor {
+public:
+    virtual ~Executor() {}
+    virtual int concurrency() const = 0;
+    virtual void parallel_for(int begin, int end, int grain, const function<void(int, int)>& body) = 0;
+};
+
+// 默认执行器: OpenMP 动态调度 (与原 #pragma omp parallel for schedule(dynamic, grain) 一致)
+class OpenMPExecutor : public Executor {
+public:
+    int concurrency() const override;
+    void parallel_for(int begin, int end, int grain, const function<void(int, int)>& body) override;
+};
+
+// 内置工作窃取线程池: 区间按 grain 切块后均分给各线程，线程先处理自己的块 (从头取)，
+// 做完后从其他线程的尾部窃取；调用线程作为 0 号线程参与。pin_threads 时按可用 CPU 依次绑核。
+// 在池内线程中嵌套调用 parallel_for 会串行执行；不同外部线程的调用依次进行。
+class WorkStealingPool : public Executor {
+public:
+    explicit WorkStealingPool(int num_threads = 0, bool pin_threads = false); // 0: 硬件线程数
+    // 每个 CPU 一个线程，worker t 固定在 cpus[t] 上 (调用线程在 parallel_for 期间绑到 cpus[0])
+    explicit WorkStealingPool(const vector<int>& cpus);
+    ~WorkStealingPool();
+    int concurrency() const override;
+    void parallel_for(int begin, int end, int grain, const function<void(int, int)>& body) override;
+
+private:
+    struct Impl;
+    unique_ptr<Impl> impl;
+};
+
 class Solution {
 public:
     // 接口约束
     void build(int d, const vector<float>& base);
     void search(const vector<float>& query, int* res);
 
+    // 构建模式
+    enum BuildMode {
+        BUILD_HNSW_INSERT,  // 逐点 HNSW 插入 (默认)
+        BUILD_NN_DESCENT,   // 并行 NN-Descent 近似 kNN 图 + RobustPrune 派生 Layer 0
+        BUILD_HNSW_WAVES,   // 预分配层级，按层级降序分波次插入 (快照上并行搜索 + 无锁批量提交反向边)
+        BUILD_PARTITIONED   // k-means 重叠分区独立建图，合并 Layer 0 后重建稀疏上层
+    };
+    void set_build_mode(BuildMode mode) { build_mode = mode; }
+
+    // 分治构建参数 (BUILD_PARTITIONED): 分区容量上限 (分区逐个构建，额外峰值内存以此为界) 与每个点所属的分区数
+    void set_partition_build(int partition_size, int overlap = 2)
+    {
+        partition_size_cfg = partition_size;
+        partition_overlap = overlap;
+    }
+
+    // RobustPrune 的 alpha (Vamana)，需在 build 前设置；1.0 为原 GAMMA 剪枝
+    void set_prune_alpha(float alpha) { prune_alpha = alpha; }
+
+    // 基向量存储格式，需在 build 前设置
+    enum VectorStorage {
+        STORAGE_FP32,  // 默认
+        STORAGE_FP16,  // IEEE half，F16C 转换
+        STORAGE_BF16   // bfloat16，AVX512_BF16 编码
+    };
+    // fp32_rerank: 额外保留 FP32 副本，仅用于最终重排
+    void set_vector_storage(VectorStorage storage, bool fp32_rerank = false)
+    {
+        vector_storage = storage;
+        keep_fp32_rerank = fp32_rerank;
+    }
+
+    // 入口点表: build 时对基向量做 k-means，每个质心映射到一个图节点，需在 build 前设置
+    // num_centroids = 0 关闭 (默认)；seeds 为每个查询使用的最近种子数 (<= 64)
+    // skip_upper_layers: 不做高层下降，直接从种子开始 Layer 0
+    void set_entry_points(int num_centroids, int seeds = 4, bool skip_upper_layers = false)
+    {
+        entry_centroids_cfg = num_centroids;
+        entry_seeds = seeds;
+        entry_skip_upper = skip_upper_layers;
+    }
+
+    // 高层 (Layer >= 1) 的存储方式，需在 build 前设置
+    enum UpperLayerMode {
+        UPPER_GRAPH,        // 直接遍历构建期的节点邻接表 (默认)
+        UPPER_COMPACT,      // 重编号 + 连续邻接表 + FP32 向量副本
+        UPPER_COMPACT_SQ8   // 同上，向量副本为 SQ8 (1 字节/维)
+    };
+    void set_upper_layers(UpperLayerMode mode) { upper_mode = mode; }
+
+    // 1-bit 二值码: Layer 0 遍历改用 popcount Hamming 距离，候选经 SQ8、FP32 两级重排，需在 build 前设置
+    // mean_threshold: 以各维均值为阈值 (否则按符号)；random_rotation: 编码前做随机正交旋转
+    void set_binary_codes(bool enable, bool mean_threshold = true, bool random_rotation = false)
+    {
+        binary_enabled = enable;
+        binary_mean_threshold = mean_threshold;
+        binary_rotate = random_rotation;
+    }
+
+    // 4-bit fast-scan PQ: 按节点邻居块存放 4-bit PQ 码，Layer 0 展开时 pshufb 查表给整个邻居表打分，
+    // 只对估计距离足够近的邻居计算精确距离；需在 build 前设置
+    // subspaces: 子空间数 (0 关闭，-1 自动为每段 2 维，上限 128)
+    void set_fastscan_pq(int subspaces) { pq4_subspaces_cfg = subspaces; }
+
+    // 降维投影: 构建与 Layer 0 遍历在 dims 维投影空间进行，最终用全维 FP32 距离重排；需在 build 前设置
+    // dims: 目标维数 (0 或不小于原维数时关闭)；random: 随机正交投影 (否则 PCA)
+    void set_projection(int dims, bool random = false)
+    {
+        proj_dims_cfg = dims;
+        proj_random = random;
+    }
+    // 投影保留的方差比例 (未投影时为 1) 与遍历维数
+    float projection_variance_retained() const { return proj_variance_retained; }
+    int projected_dimension() const { return dimension; }
+
+    // 有界距离: Layer 0 结果集已满时，部分和超过当前最差距离即停止计算 (默认开启)
+    void set_early_abandon(bool enable) { early_abandon = enable; }
+    // 按方差降序重排维度 (构建期，查询自动按同一顺序重排)，使有界距离更早终止；需在 build 前设置
+    void set_dimension_reorder(bool enable) { reorder_dims_cfg = enable; }
+
+    // 压缩 Layer 0 邻接表: 邻居按 id 升序、差分位打包存储，遍历时 SIMD 解码；需在 build 前设置
+    void set_compressed_adjacency(bool enable) { compress_adjacency_cfg = enable; }
+    // Layer 0 邻接表占用的字节数 (含偏移数组)
+    size_t layer0_graph_bytes() const;
+
+    // 查询 ef (默认 EF_SEARCH，上限 2048)
+    void set_ef_search(int ef) { custom_ef_search = ef; }
+
+    // 自适应终止: Layer 0 上 top-10 连续 patience 次扩展未变化即停止，0 关闭
+    void set_adaptive_termination(int patience) { adaptive_patience = patience; }
+    // 用样本查询校准 patience: 相对完整 ef 结果的 Recall@10 不低于 target_recall，返回选定值
+    int calibrate_adaptive_termination(const vector<vector<float>>& sample_queries, float target_recall);
+
+    // 软件预取: distance 为提前的邻居数，lines 为每条向量预取的缓存行数
+    // -1 表示按维度自动选择，distance = 0 关闭预取
+    void set_prefetch(int distance, int lines);
+
+    // 批量查询: res 依次存放每个 query 的 top-10 (大小 queries.size() * 10)
+    void search_batch(const vector<vector<float>>& queries, int* res);
+
+    // 精确 kNN (分块 GEMM 式 SIMD 内核，批量接口经执行器多线程，每查询有界 top-k 堆)
+    // 索引规模不超过 4096 时 search 自动使用该引擎 (单查询串行，由调用方在查询间并行)
+    void search_exact_batch(const vector<vector<float>>& queries, int* res, int k = 10) const;
+    // 只在给定 id 子集中精确搜索 (高选择性过滤的回退路径)
+    void search_exact_subset(const vector<float>& query, const vector<int>& ids, int* res) const;
+    void search_brute_force(const vector<float>& query, int* res) const;
+    // 不建索引，直接对原始数据求精确 kNN (res / dists 为 queries.size() * k，dists 可为空)
+    static void exact_knn(const float* base, int n, int d, const vector<vector<float>>& queries, int k,
+                          int* res, float* dists);
+    // 生成 ground truth 文件 (每行 k 个 id，空格分隔，与 groundtruth.txt 格式一致)
+    static bool write_groundtruth(const string& path, const vector<float>& base, int d,
+                                  const vector<vector<float>>& queries, int k);
+
+    // 同 search，并在 dists 中返回对应的精确 L2 平方距离 (供分片归并)
+    void search_with_distances(const vector<float>& query, int* res, float* dists);
+
+    // 查询结果缓存: 最多 capacity 条 (0 关闭)，以 SQ8 编码后的查询为键，CLOCK 淘汰
+    // 作用于 search 与 search_batch (交错路径逐查询查找/写入)；build 会清空缓存
+    void set_result_cache(size_t capacity);
+
+    // 并行执行器 (build、flatten、量化与 search_batch 使用)；nullptr 恢复默认的 OpenMP
+    void set_executor(shared_ptr<Executor> executor) { custom_executor = executor; }
+    void clear_result_cache();
+    struct ResultCacheStats {
+        uint64_t hits;
+        uint64_t misses;
+        size_t entries;
+    };
+    ResultCacheStats result_cache_stats() const;
+
+    // 单查询并行: num_threads 个线程共同展开一个查询的 Layer 0 (适合大 ef、低延迟场景)
+    // 并行查询之间互斥；不支持自适应终止
+    void search_intra_parallel(const vector<float>& query, int* res, int num_threads);
+
+    // 交错批量查询: 每个线程同时推进 group 个查询，用预取隐藏访存延迟 (1 为逐个查询)
+    void set_batch_interleave(int group) { batch_interleave = group; }
+
+    // NUMA: 为每个节点复制一份只读查询结构 (build 之后调用)，返回副本数
+    // 同时创建每个节点 CPU 一个线程的绑核线程池；启用后 search_batch 改由该池执行 (不经 set_executor)，
+    // 每个线程固定读所在节点的副本，副本与本实例共享结果缓存；build 会使副本失效
+    int enable_numa_replicas();
+    void disable_numa_replicas();
+
+    // SSD 常驻模式 (build 之后调用):
+    // save_disk_index 把 Layer 0 邻接表与全精度向量按设备的 O_DIRECT 对齐写入文件；
+    // open_disk_index 打开该文件并释放内存中的对应部分，只保留 SQ8 码、紧凑高层与
+    // 从 enter_point 起 BFS 的 cache_nodes 个热点节点；之后 search 走 beam search + 批量读盘
+    // (定义 USE_LIBURING 时用 io_uring，否则 pread 线程池)。build 会退出该模式。
+    // 需在 build 前 set_upper_layers(UPPER_COMPACT / UPPER_COMPACT_SQ8)，否则 open 返回 false。
+    // 读盘失败的查询结果填 -1 (search_with_distances 的距离为 +inf)，并计入 io_errors
+    bool save_disk_index(const string& path) const;
+    bool open_disk_index(const string& path, int cache_nodes);
+    struct DiskIndexStats {
+        uint64_t reads;       // 实际读盘的节点记录数
+        uint64_t cache_hits;  // 热点缓存命中数
+        uint64_t io_errors;   // 因读盘失败而作废的查询数
+        bool direct_io;       // 是否以 O_DIRECT 打开
+    };
+    DiskIndexStats disk_index_stats() const;
+
+    // 大页: 影响之后的大块分配 (进程级设置)，默认 THP
+    enum HugePageMode {
+        HUGEPAGE_OFF,     // 普通 4 KiB 页
+        HUGEPAGE_THP,     // madvise(MADV_HUGEPAGE)
+        HUGEPAGE_HUGETLB  // 显式 MAP_HUGETLB (2 MiB / 1 GiB)，失败回退 THP
+    };
+    static void set_huge_page_mode(HugePageMode mode);
+
+    // 索引大数组的大页覆盖情况 (Linux 下读取 /proc/self/smaps)
+    struct HugePageStats {
+        size_t total_bytes;
+        size_t huge_bytes;
+    };
+    HugePageStats huge_page_stats() const;
+
 private:
+    friend class ShardedSolution;
+    friend class IvfSolution;
+
+    BuildMode build_mode = BUILD_HNSW_INSERT;
+    float prune_alpha = 1.0f;
+    VectorStorage vector_storage = STORAGE_FP32;
+    bool keep_fp32_rerank = false;
+
+    int custom_ef_search = 0;
+    int entry_centroids_cfg = 0;
+    int entry_seeds = 4;
+    bool entry_skip_upper = false;
+    UpperLayerMode upper_mode = UPPER_GRAPH;
+    bool binary_enabled = false;
+    bool binary_mean_threshold = true;
+    bool binary_rotate = false;
+    int pq4_subspaces_cfg = 0;
+    int proj_dims_cfg = 0;
+    bool proj_random = false;
+    bool early_abandon = true;
+    bool reorder_dims_cfg = false;
+    bool compress_adjacency_cfg = false;
+    int partition_size_cfg = 100000;
+    int partition_overlap = 2;
+    int adaptive_patience = 0;
+    int batch_interleave = 1;
+
+    // 预取配置 (-1: 自动) 与生效值
+    int prefetch_distance_cfg = -1;
+    int prefetch_lines_cfg = -1;
+    int pf_distance = 2;
+    int pf_lines = 1;
+    int adj_lines = 1;
+
     // --- 数据存储 ---
-    int dimension;
-    int num_vectors;
+    int dimension = 0;
+    int num_vectors = 0;
     
     // 原始向量 (用于构建和高层搜索)
-    vector<float> data_flat; 
+    // 半精度模式下为可选的 FP32 重排副本 (可为空)
+    huge_vector<float> data_flat; 
+
+    // 降维投影: 投影矩阵 (dimension x full_dimension，行正交) 与全维 FP32 向量 (重排/精确搜索)
+    int full_dimension = 0;
+    vector<float> proj_matrix;
+    huge_vector<float> data_full;
+    float proj_variance_retained = 1.0f;
+
+    // 维度重排 (无投影时): 索引空间第 j 维 = 原向量第 dim_order[j] 维；为空表示未重排
+    vector<int> dim_order;
+
+    // 二值码 (每向量 binary_words 个 64 位字)、各维阈值与可选旋转矩阵 (dim x dim)
+    huge_vector<uint64_t> data_binary;
+    vector<float> binary_threshold;
+    vector<float> binary_rotation;
+    int binary_words = 0;
+
+    // 4-bit fast-scan PQ: 子空间边界、码本 (段 s 的 16 个质心连续存放于 sub_begin[s] * 16 处)、
+    // 按节点的邻居块 (每块 32 个邻居 x 子空间数 x 16 字节) 及其偏移
+    int pq4_subspaces = 0;
+    vector<int> pq4_sub_begin;
+    vector<float> pq4_centroids;
+    huge_vector<uint8_t> pq4_blocks;
+    huge_vector<size_t> pq4_block_offsets;
+
+    // 基向量范数 ||x||² (精确 kNN 引擎)
+    huge_vector<float> data_norms;
+
+    // 半精度基向量 (FP16/BF16 模式)
+    huge_vector<uint16_t> data_half;
     
     // 量化相关 (用于Layer 0快速搜索)
-    vector<unsigned char> data_quant;
+    huge_vector<unsigned char> data_quant;
     float global_min;
     float global_scale_inv;
     bool use_quantization;
@@ -37,45 +334,254 @@ private:
         // [level][neighbor_index]
         // 注意：构建完成后，Level 0 将被移动到 final_graph_flat 优化访问
         vector<vector<int>> neighbors; 
+        // 构建期: 与 neighbors 一一对应的距离，避免溢出剪枝时重算；build 结束后释放
+        vector<vector<float>> neighbor_dists;
     };
     vector<Node> nodes;
     
     // 优化后的 Layer 0 (扁平化存储: [size, n1, n2, ..., size, n1, ...])
-    vector<int> final_graph_flat;
-    vector<size_t> final_graph_offsets; // 快速定位 flattened graph
+    huge_vector<int> final_graph_flat;
+    huge_vector<size_t> final_graph_offsets; // 快速定位 flattened graph (压缩时为 graph_packed 的字节偏移)
+
+    // 压缩 Layer 0 邻接表 (非空时 final_graph_flat 已释放)
+    huge_vector<uint8_t> graph_packed;
 
     int max_level;
     int enter_point;
     int M_max;
     int M_max0;
+
+    // 紧凑高层: 紧凑编号 -> 原编号，邻接表 ([count, n...]，紧凑编号) 及其偏移
+    // upper_offsets[c * max_level + (lc - 1)]，不在该层的节点指向位置 0 的空表
+    vector<int> upper_ids;
+    huge_vector<int> upper_adj;
+    huge_vector<size_t> upper_offsets;
+    huge_vector<float> upper_vectors;        // UPPER_COMPACT
+    huge_vector<unsigned char> upper_quant;  // UPPER_COMPACT_SQ8
+    int upper_enter = 0;
+
+    // 入口点表: 质心 (k x dim, FP32) 与其对应的图节点
+    huge_vector<float> entry_centroids;
+    vector<int> entry_nodes;
     
+    // --- SSD 常驻模式 ---
+    struct DiskIndex;
+    shared_ptr<DiskIndex> disk;
+
+    // 并行执行器 (为空时使用 OpenMPExecutor)
+    shared_ptr<Executor> custom_executor;
+    Executor& executor() const;
+    void encode_disk_record(int id, char* dst, size_t record_size, int max_neighbors) const;
+    bool search_disk(const float* query, const unsigned char* query_quant, int* res, float* dists) const;
+    // search / search_with_distances 的共用实现 (dists 可为空)
+    void search_query(const float* query, int* res, float* dists);
+
+    // 精确搜索 (subset 为空时搜索全部基向量；exec 为空时串行)
+    void exact_search(const float* const* queries, int nq, int k, int* res, float* dists,
+                      const vector<int>* subset, Executor* exec = nullptr) const;
+
+    // --- 查询结果缓存 ---
+    struct ResultCache;
+    shared_ptr<ResultCache> result_cache;
+
+    // --- 单查询并行的共享状态 (原子 visited 数组等) ---
+    struct IntraQueryState;
+    shared_ptr<IntraQueryState> intra_state;
+
+    // --- NUMA 副本 ---
+    vector<shared_ptr<Solution>> numa_replicas;
+    shared_ptr<WorkStealingPool> numa_pool; // worker t 绑定在副本 numa_worker_replica[t] 的节点上
+    vector<int> numa_worker_replica;
+    void copy_query_structures(const Solution& src);
+
     // --- 内部辅助方法 ---
     
     // 距离计算
-    float dist_l2_float_avx(const float* a, const float* b, int d) const;
+    static float dist_l2_float_avx(const float* a, const float* b, int d);
     float dist_l2_quant(int id_a, const unsigned char* b_quant, int d) const;
+    float dist_l2_fp16(const float* a, const uint16_t* b, int d) const;
+    float dist_l2_bf16(const float* a, const uint16_t* b, int d) const;
+
+    // 存储无关的访问接口 (按 vector_storage 分派)
+    float dist_query(const float* query, int id) const;
+    float dist_full(const float* query, int id) const;
+    float dist_query_bounded(const float* query, int id, float bound) const;
+    float dist_nodes(int a, int b) const;
+    const float* get_vector(int id, float* buf) const;
+    const char* vector_addr(int id) const;
+
+    // 半精度编解码
+    void encode_half(const float* src, uint16_t* dst) const;
+    void decode_half(const uint16_t* src, float* dst) const;
     
+    // 预取
+    void configure_prefetch();
+    void prefetch_vector(int id) const;
+    void prefetch_adjacency(int id) const;
+
     // 量化工具
     void init_quantization();
+    void build_binary_codes();
+    void encode_binary(const float* src, uint64_t* dst) const;
+    void build_pq4_codes();
+    void build_pq4_lut(const float* query, uint8_t* lut, float& lut_bias, float& lut_scale) const;
+    void pq4_scan_neighbors(int id, int count, const uint8_t* lut, uint16_t* out) const;
     void quantize_vec(const float* src, unsigned char* dst) const;
 
+    // 降维投影
+    float train_projection(const vector<float>& base, int d);
+    void project_vector(const float* src, float* dst) const;
+    const float* traversal_query(const float* query) const;
+    static vector<int> variance_order(const vector<float>& base, int d);
+    const float* index_query(const float* query, vector<float>& buf) const;
+
     // 图操作
-    int get_random_level();
-    void get_neighbors_heuristic(vector<int>& result, const vector<int>& candidates, int k) const;
+    int get_random_level(float level_mult);
+    // RobustPrune: sorted_cand 需按到基准点的距离升序 (正向/反向边共用)
+    void get_neighbors_heuristic(vector<pair<float, int>>& result, const vector<pair<float, int>>& sorted_cand, int k) const;
+    // 反向连接 (邻居表满时剪枝)；dedup 跳过已存在的边 (NN-Descent / 分区合并时双向边可能已在表中)
+    void connect_reverse(int id, const vector<pair<float, int>>& selected, int lc, int M_limit,
+                         vector<std::mutex>& node_locks, bool dedup = false);
+    // 将节点 id 插入 [min_layer, level] 各层
+    void insert_point(int id, int level, int min_layer, vector<std::mutex>& node_locks);
+
+    // 构建模式实现
+    void build_hnsw_insert(vector<std::mutex>& node_locks);
+    void build_nn_descent(vector<std::mutex>& node_locks);
+    void build_hnsw_waves();
+    void build_partitioned(vector<std::mutex>& node_locks);
+    void build_graph_only(int d, huge_vector<float>&& vectors);
+    void build_sparse_upper_layers(vector<std::mutex>& node_locks);
+    int greedy_descend(const float* query, int ep, int top_level, int target_level,
+                       vector<std::mutex>* node_locks = nullptr) const;
+    const vector<int>& locked_neighbors(int id, int lc, vector<std::mutex>& node_locks) const;
     
     // 核心搜索逻辑 (分为构建用和查询用)
     
-    // 1. 通用/构建搜索 (精确距离，动态图)
-    void search_layer_build(const float* query, std::vector<int>& candidates, 
-                            const std::vector<int>& ep, int ef, int lc) const;
+    // 1. 通用/构建搜索 (精确距离，动态图；结果携带距离并升序)
+    //    node_locks 非空时在节点锁内读取邻居表 (并发插入)；为空时图须为只读快照
+    void search_layer_build(const float* query, std::vector<pair<float, int>>& candidates, 
+                            const std::vector<int>& ep, int ef, int lc,
+                            vector<std::mutex>* node_locks = nullptr) const;
 
     // 2. 最终查询搜索 (混合精度，Layer 0扁平化)
     void search_layer_query(const float* query, const unsigned char* query_quant, 
                             std::vector<int>& candidates, const std::vector<int>& ep, 
                             int ef, int lc) const;
                             
+    // 3. 查询流程的组成部分 (search / search_group 共用)
+    int query_ef() const;
+    int descend_upper_layers(const float* query) const;
+    int descend_upper_compact(const float* query) const;
+    void select_entry_points(const float* query, vector<int>& eps) const;
+    void narrow_binary_candidates(const unsigned char* query_quant, vector<int>& candidates) const;
+    void rerank_topk(const float* query, const vector<int>& candidates, int* res) const;
+
+    // 4. 交错多查询 Layer 0 遍历，结果写入 res + q * 10
+    void search_group(const vector<vector<float>>& queries, int begin, int end, int* res);
+    // 5. 小索引 (不超过 EXACT_FALLBACK_MAX) 的批量查询: 整批精确搜索
+    void search_batch_exact(const vector<vector<float>>& queries, int* res);
+
     // 扁平化 Layer 0
     void flatten_layer0();
+    void compress_layer0();
+    int decode_layer0(int id, int* out) const;
+    // Layer 0 邻居表: 未压缩时指向 final_graph_flat，压缩时解码到 buf
+    const int* layer0_neighbors(int id, int* buf, int& count) const;
+    // 紧凑高层
+    void build_upper_layers();
+    // 入口点表 (k-means 质心 -> 图节点)
+    void build_entry_table();
+
+    // k-means (入口点表 / 分片划分共用)
+    static void train_kmeans(const float* data, int n, int d, int k, int iters, unsigned seed,
+                             vector<float>& centroids, Executor* executor = nullptr);
+    static int nearest_centroid(const float* v, const float* centroids, int k, int d);
+
+    // 拷贝后不再共享缓存等运行期状态
+    void detach_shared_state();
+};
+
+// 分片索引: 基向量划分到 N 个 Solution 分片，分片经原型的执行器并行构建；
+// 查询分发到全部分片 (或按质心路由到最近的若干分片)，按精确距离归并 top-10
+class ShardedSolution {
+public:
+    // prototype: 各分片的配置模板 (build 前的 set_* 设置)
+    explicit ShardedSolution(int num_shards, const Solution& prototype = Solution());
+
+    enum PartitionMode {
+        PARTITION_ROUND_ROBIN, // 均匀轮转划分，查询分发到全部分片 (默认)
+        PARTITION_KMEANS       // k-means 划分，可按质心路由
+    };
+    void set_partition(PartitionMode mode) { partition = mode; }
+    // k-means 划分下每个查询访问的最近分片数，0 为全部
+    void set_probe_shards(int n) { probe_shards = n; }
+
+    void build(int d, const vector<float>& base);
+    void search(const vector<float>& query, int* res);
+    void search_batch(const vector<vector<float>>& queries, int* res);
+
+    int num_shards() const { return (int)shards.size(); }
+
+private:
+    PartitionMode partition = PARTITION_ROUND_ROBIN;
+    int probe_shards = 0;
+    int dimension = 0;
+
+    vector<Solution> shards;
+    vector<vector<int>> local_to_global; // [shard][局部 id] -> 全局 id
+    vector<float> centroids;             // k-means 划分的分片质心 (num_shards x dim)
+
+    void route(const float* query, vector<int>& targets) const;
+    void search_shards(const vector<float>& query, int* res, bool fan_out);
+    // 并行执行器: 原型的 set_executor (未设置时为默认 OpenMP)
+    Executor& executor() const;
+};
+
+// --- IVF 倒排索引 (与 Solution 并列的另一种引擎) ---
+// k-means 粗量化器把基向量分到 nlist 个倒排表，每个表的 id 与向量 (FP32 或按维 SQ8) 连续存放；
+// 查询扫描最近的 nprobe 个表。search_batch 先为全部查询选表，再按表分组，
+// 每个表只读一遍、同时服务所有探测它的查询，最后合并各表的部分 top-10。
+struct IvfTopK;
+class IvfSolution {
+public:
+    // 倒排表数 (0: 自动，约 4 * sqrt(N))，需在 build 前设置
+    void set_num_lists(int n) { num_lists_cfg = n; }
+    // 每个查询扫描的表数
+    void set_nprobe(int n) { nprobe = n; }
+    // 表内向量存为按维 SQ8 (1 字节/维，非对称距离)，需在 build 前设置
+    void set_sq8(bool enable) { use_sq8 = enable; }
+    // 并行执行器 (build 与 search_batch 使用)；nullptr 恢复默认的 OpenMP
+    void set_executor(shared_ptr<Executor> executor) { custom_executor = executor; }
+
+    void build(int d, const vector<float>& base);
+    void search(const vector<float>& query, int* res) const;
+    void search_batch(const vector<vector<float>>& queries, int* res) const;
+
+    int num_lists() const { return nlist; }
+
+private:
+    int num_lists_cfg = 0;
+    int nprobe = 32;
+    bool use_sq8 = false;
+
+    int dimension = 0;
+    int num_vectors = 0;
+    int nlist = 0;
+    vector<float> centroids;          // nlist x dim
+    vector<size_t> list_offsets;      // nlist + 1
+    huge_vector<int> list_ids;        // 按表连续存放的原始 id
+    huge_vector<float> list_vectors;  // FP32 模式
+    huge_vector<uint8_t> list_codes;  // SQ8 模式
+    vector<float> sq_min, sq_step;    // SQ8 按维参数: x ~ min + code * step
+    vector<float> sq_weight;          // step^2 (距离权重)
+
+    shared_ptr<Executor> custom_executor;
+    Executor& executor() const;
+
+    void probe_lists(const float* query, vector<pair<float, int>>& order, int* lists) const;
+    void prepare_query(const float* query, float* prepared) const;
+    void scan_list(int list, const float* const* prepared, int nq, IvfTopK* heaps) const;
 };
 
 #endif // MYSOLUTION_H
\ No newline at end of file
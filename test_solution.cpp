@@ -201,6 +201,138 @@ double calculate_recall(const vector<vector<int>> &results, const vector<vector<
     return (double)total_recall / (results.size() * k);
 }
 
+// 用精确 kNN 引擎生成 ground truth，并与数据集自带的 groundtruth.txt 对比
+int run_write_groundtruth(const string &dataset_dir, const string &output)
+{
+    int dimension = 0, num_vectors = 0;
+    vector<float> base_vectors = load_base_vectors(dataset_dir + "/base.txt", dimension, num_vectors);
+    vector<vector<float>> queries = load_query_vectors(dataset_dir + "/query.txt", dimension);
+    if (base_vectors.empty() || queries.empty())
+    {
+        cerr << "Failed to load dataset" << endl;
+        return 1;
+    }
+
+    auto start = chrono::high_resolution_clock::now();
+    if (!Solution::write_groundtruth(output, base_vectors, dimension, queries, 10))
+    {
+        cerr << "Failed to write groundtruth: " << output << endl;
+        return 1;
+    }
+    auto end = chrono::high_resolution_clock::now();
+    cout << "[GROUNDTRUTH] " << queries.size() << " x " << num_vectors << " exact 10-NN in "
+         << chrono::duration_cast<chrono::milliseconds>(end - start).count() << " ms -> " << output << endl;
+
+    const string reference_file = dataset_dir + "/groundtruth.txt";
+    if (output == reference_file)
+        return 0;
+    vector<vector<int>> reference = load_groundtruth(reference_file);
+    vector<vector<int>> written = load_groundtruth(output);
+    if (!reference.empty() && reference.size() == written.size())
+    {
+        cout << "Agreement with groundtruth.txt (Recall@10): " << fixed << setprecision(4)
+             << calculate_recall(written, reference, 10) << endl;
+    }
+    return 0;
+}
+
+// 分片索引: 构建 + 批量查询 + 召回率
+int run_sharded(const string &dataset_dir, int num_shards, bool kmeans, int probe, const Solution &prototype)
+{
+    int dimension = 0, num_vectors = 0;
+    vector<float> base_vectors = load_base_vectors(dataset_dir + "/base.txt", dimension, num_vectors);
+    vector<vector<float>> queries = load_query_vectors(dataset_dir + "/query.txt", dimension);
+    vector<vector<int>> groundtruth = load_groundtruth(dataset_dir + "/groundtruth.txt");
+    if (base_vectors.empty() || queries.empty())
+    {
+        cerr << "Failed to load dataset" << endl;
+        return 1;
+    }
+
+    ShardedSolution sharded(num_shards, prototype);
+    sharded.set_partition(kmeans ? ShardedSolution::PARTITION_KMEANS : ShardedSolution::PARTITION_ROUND_ROBIN);
+    sharded.set_probe_shards(probe);
+
+    cout << "[SHARDED] " << num_shards << " shards (" << (kmeans ? "k-means" : "round-robin")
+         << ", probe " << (probe > 0 ? to_string(probe) : string("all")) << ")" << endl;
+    auto build_start = chrono::high_resolution_clock::now();
+    sharded.build(dimension, base_vectors);
+    auto build_end = chrono::high_resolution_clock::now();
+    cout << "  Build time: " << chrono::duration_cast<chrono::milliseconds>(build_end - build_start).count()
+         << " ms" << endl;
+
+    vector<int> batch_results(queries.size() * 10);
+    auto search_start = chrono::high_resolution_clock::now();
+    sharded.search_batch(queries, batch_results.data());
+    auto search_end = chrono::high_resolution_clock::now();
+    auto search_time = chrono::duration_cast<chrono::microseconds>(search_end - search_start).count();
+    cout << "  Average time: " << fixed << setprecision(2) << (double)search_time / 1000.0 / queries.size()
+         << " ms/query" << endl;
+
+    if (groundtruth.size() == queries.size())
+    {
+        vector<vector<int>> all_results;
+        for (size_t i = 0; i < queries.size(); ++i)
+            all_results.push_back(vector<int>(batch_results.begin() + i * 10, batch_results.begin() + (i + 1) * 10));
+        cout << "Recall@10: " << fixed << setprecision(4) << calculate_recall(all_results, groundtruth, 10) << endl;
+    }
+    return 0;
+}
+
+// IVF 倒排索引: 构建 + 单条/批量查询 + 召回率 (与 HNSW 共用加载与召回统计)
+int run_ivf(const string &dataset_dir, int nlist, int nprobe, bool sq8, shared_ptr<Executor> executor)
+{
+    int dimension = 0, num_vectors = 0;
+    vector<float> base_vectors = load_base_vectors(dataset_dir + "/base.txt", dimension, num_vectors);
+    vector<vector<float>> queries = load_query_vectors(dataset_dir + "/query.txt", dimension);
+    vector<vector<int>> groundtruth = load_groundtruth(dataset_dir + "/groundtruth.txt");
+    if (base_vectors.empty() || queries.empty())
+    {
+        cerr << "Failed to load dataset" << endl;
+        return 1;
+    }
+
+    IvfSolution ivf;
+    ivf.set_num_lists(nlist);
+    ivf.set_nprobe(nprobe);
+    ivf.set_sq8(sq8);
+    ivf.set_executor(executor);
+
+    auto build_start = chrono::high_resolution_clock::now();
+    ivf.build(dimension, base_vectors);
+    auto build_end = chrono::high_resolution_clock::now();
+    cout << "[IVF] " << ivf.num_lists() << " lists, nprobe " << nprobe << ", " << (sq8 ? "SQ8" : "FP32") << endl;
+    cout << "  Build time: " << chrono::duration_cast<chrono::milliseconds>(build_end - build_start).count()
+         << " ms" << endl;
+
+    vector<vector<int>> all_results(queries.size(), vector<int>(10));
+    auto search_start = chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < queries.size(); ++i)
+        ivf.search(queries[i], all_results[i].data());
+    auto search_end = chrono::high_resolution_clock::now();
+    auto search_time = chrono::duration_cast<chrono::microseconds>(search_end - search_start).count();
+    cout << "  Average time (single): " << fixed << setprecision(2) << (double)search_time / 1000.0 / queries.size()
+         << " ms/query" << endl;
+
+    vector<int> batch_results(queries.size() * 10);
+    search_start = chrono::high_resolution_clock::now();
+    ivf.search_batch(queries, batch_results.data());
+    search_end = chrono::high_resolution_clock::now();
+    search_time = chrono::duration_cast<chrono::microseconds>(search_end - search_start).count();
+    cout << "  Average time (batch): " << fixed << setprecision(2) << (double)search_time / 1000.0 / queries.size()
+         << " ms/query" << endl;
+
+    if (groundtruth.size() == queries.size())
+    {
+        vector<vector<int>> batch_vectors;
+        for (size_t i = 0; i < queries.size(); ++i)
+            batch_vectors.push_back(vector<int>(batch_results.begin() + i * 10, batch_results.begin() + (i + 1) * 10));
+        cout << "Recall@10 (single): " << fixed << setprecision(4) << calculate_recall(all_results, groundtruth, 10) << endl;
+        cout << "Recall@10 (batch): " << fixed << setprecision(4) << calculate_recall(batch_vectors, groundtruth, 10) << endl;
+    }
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
     // Default to SIFT dataset
@@ -209,6 +341,47 @@ int main(int argc, char *argv[])
     bool use_cache = false;
     bool save_cache = false;
     int custom_ef_search = -1;
+    Solution::BuildMode build_mode = Solution::BUILD_HNSW_INSERT;
+    float prune_alpha = -1.0f;
+    Solution::VectorStorage storage = Solution::STORAGE_FP32;
+    bool fp32_rerank = false;
+    bool batch_search = false;
+    bool numa_replicas = false;
+    bool bench_prefetch = false;
+    int interleave = 1;
+    int intra_threads = 1;
+    int entry_centroids = 0;
+    int entry_seeds = 4;
+    bool entry_skip_upper = false;
+    Solution::UpperLayerMode upper_mode = Solution::UPPER_GRAPH;
+    int result_cache = 0;
+    int shards = 0;
+    bool shard_kmeans = false;
+    int shard_probe = 0;
+    bool ivf = false;
+    int ivf_lists = 0;
+    int ivf_probe = 32;
+    bool ivf_sq8 = false;
+    string disk_index_path;
+    string write_gt_path;
+    bool exact_search = false;
+    bool binary_codes = false;
+    bool binary_mean = true;
+    bool binary_rotate = false;
+    int fastscan_pq = 0;
+    int projection_dims = 0;
+    bool projection_random = false;
+    bool early_abandon = true;
+    bool reorder_dims = false;
+    bool compress_adjacency = false;
+    bool rebuild = false;
+    int pool_threads = -1; // -1: OpenMP (默认)
+    int partition_size = 0;
+    int partition_overlap = 2;
+    bool pin_threads = false;
+    int disk_cache_nodes = 10000;
+    int adaptive_patience = 0;
+    float adaptive_target = 0.0f;
 
     if (argc > 1)
     {
@@ -232,6 +405,234 @@ int main(int argc, char *argv[])
             custom_ef_search = atoi(argv[i + 1]);
             ++i;
         }
+        else if (arg == "--build-mode" && i + 1 < argc)
+        {
+            string mode = argv[i + 1];
+            if (mode == "nndescent")
+            {
+                build_mode = Solution::BUILD_NN_DESCENT;
+            }
+            else if (mode == "waves")
+            {
+                build_mode = Solution::BUILD_HNSW_WAVES;
+            }
+            else if (mode == "partition")
+            {
+                build_mode = Solution::BUILD_PARTITIONED;
+            }
+            ++i;
+        }
+        else if (arg == "--storage" && i + 1 < argc)
+        {
+            string fmt = argv[i + 1];
+            if (fmt == "fp16")
+            {
+                storage = Solution::STORAGE_FP16;
+            }
+            else if (fmt == "bf16")
+            {
+                storage = Solution::STORAGE_BF16;
+            }
+            ++i;
+        }
+        else if (arg == "--fp32-rerank")
+        {
+            fp32_rerank = true;
+        }
+        else if (arg == "--hugepages" && i + 1 < argc)
+        {
+            string mode = argv[i + 1];
+            if (mode == "off")
+            {
+                Solution::set_huge_page_mode(Solution::HUGEPAGE_OFF);
+            }
+            else if (mode == "hugetlb")
+            {
+                Solution::set_huge_page_mode(Solution::HUGEPAGE_HUGETLB);
+            }
+            else
+            {
+                Solution::set_huge_page_mode(Solution::HUGEPAGE_THP);
+            }
+            ++i;
+        }
+        else if (arg == "--adaptive" && i + 1 < argc)
+        {
+            adaptive_patience = atoi(argv[i + 1]);
+            ++i;
+        }
+        else if (arg == "--adaptive-calibrate" && i + 1 < argc)
+        {
+            adaptive_target = atof(argv[i + 1]);
+            ++i;
+        }
+        else if (arg == "--bench-prefetch")
+        {
+            bench_prefetch = true;
+        }
+        else if (arg == "--interleave" && i + 1 < argc)
+        {
+            batch_search = true;
+            interleave = atoi(argv[i + 1]);
+            ++i;
+        }
+        else if (arg == "--intra-threads" && i + 1 < argc)
+        {
+            intra_threads = atoi(argv[i + 1]);
+            ++i;
+        }
+        else if (arg == "--entry-points" && i + 1 < argc)
+        {
+            entry_centroids = atoi(argv[i + 1]);
+            ++i;
+        }
+        else if (arg == "--entry-seeds" && i + 1 < argc)
+        {
+            entry_seeds = atoi(argv[i + 1]);
+            ++i;
+        }
+        else if (arg == "--entry-skip-upper")
+        {
+            entry_skip_upper = true;
+        }
+        else if (arg == "--upper-layers" && i + 1 < argc)
+        {
+            string mode = argv[i + 1];
+            if (mode == "compact")
+                upper_mode = Solution::UPPER_COMPACT;
+            else if (mode == "sq8")
+                upper_mode = Solution::UPPER_COMPACT_SQ8;
+            ++i;
+        }
+        else if (arg == "--result-cache" && i + 1 < argc)
+        {
+            result_cache = atoi(argv[i + 1]);
+            ++i;
+        }
+        else if (arg == "--shards" && i + 1 < argc)
+        {
+            shards = atoi(argv[i + 1]);
+            ++i;
+        }
+        else if (arg == "--shard-kmeans")
+        {
+            shard_kmeans = true;
+        }
+        else if (arg == "--shard-probe" && i + 1 < argc)
+        {
+            shard_probe = atoi(argv[i + 1]);
+            ++i;
+        }
+        else if (arg == "--rebuild")
+        {
+            rebuild = true;
+        }
+        else if (arg == "--ivf")
+        {
+            ivf = true;
+        }
+        else if (arg == "--nlist" && i + 1 < argc)
+        {
+            ivf_lists = atoi(argv[i + 1]);
+            ++i;
+        }
+        else if (arg == "--nprobe" && i + 1 < argc)
+        {
+            ivf_probe = atoi(argv[i + 1]);
+            ++i;
+        }
+        else if (arg == "--ivf-sq8")
+        {
+            ivf_sq8 = true;
+        }
+        else if (arg == "--disk-index" && i + 1 < argc)
+        {
+            disk_index_path = argv[i + 1];
+            ++i;
+        }
+        else if (arg == "--disk-cache" && i + 1 < argc)
+        {
+            disk_cache_nodes = atoi(argv[i + 1]);
+            ++i;
+        }
+        else if (arg == "--write-groundtruth" && i + 1 < argc)
+        {
+            write_gt_path = argv[i + 1];
+            ++i;
+        }
+        else if (arg == "--exact")
+        {
+            exact_search = true;
+        }
+        else if (arg == "--binary" && i + 1 < argc)
+        {
+            binary_codes = true;
+            binary_mean = string(argv[i + 1]) != "sign";
+            ++i;
+        }
+        else if (arg == "--binary-rotate")
+        {
+            binary_rotate = true;
+        }
+        else if (arg == "--fastscan-pq" && i + 1 < argc)
+        {
+            fastscan_pq = atoi(argv[i + 1]);
+            ++i;
+        }
+        else if (arg == "--projection" && i + 1 < argc)
+        {
+            projection_dims = atoi(argv[i + 1]);
+            ++i;
+        }
+        else if (arg == "--projection-random")
+        {
+            projection_random = true;
+        }
+        else if (arg == "--no-early-abandon")
+        {
+            early_abandon = false;
+        }
+        else if (arg == "--reorder-dims")
+        {
+            reorder_dims = true;
+        }
+        else if (arg == "--compress-graph")
+        {
+            compress_adjacency = true;
+        }
+        else if (arg == "--work-stealing" && i + 1 < argc)
+        {
+            pool_threads = atoi(argv[i + 1]);
+            ++i;
+        }
+        else if (arg == "--pin-threads")
+        {
+            pin_threads = true;
+        }
+        else if (arg == "--partition-size" && i + 1 < argc)
+        {
+            partition_size = atoi(argv[i + 1]);
+            ++i;
+        }
+        else if (arg == "--partition-overlap" && i + 1 < argc)
+        {
+            partition_overlap = atoi(argv[i + 1]);
+            ++i;
+        }
+        else if (arg == "--batch")
+        {
+            batch_search = true;
+        }
+        else if (arg == "--numa-replicas")
+        {
+            batch_search = true;
+            numa_replicas = true;
+        }
+        else if (arg == "--prune-alpha" && i + 1 < argc)
+        {
+            prune_alpha = atof(argv[i + 1]);
+            ++i;
+        }
     }
 
     string base_file = dataset_dir + "/base.txt";
@@ -243,6 +644,53 @@ int main(int argc, char *argv[])
 
     // Try to load cached graph first
     Solution solution;
+    solution.set_build_mode(build_mode);
+    solution.set_vector_storage(storage, fp32_rerank);
+    solution.set_entry_points(entry_centroids, entry_seeds, entry_skip_upper);
+    // SSD 常驻模式的高层下降依赖紧凑副本
+    if (!disk_index_path.empty() && upper_mode == Solution::UPPER_GRAPH)
+    {
+        cout << "Disk index requires compact upper layers, using --upper-layers sq8" << endl;
+        upper_mode = Solution::UPPER_COMPACT_SQ8;
+    }
+    solution.set_upper_layers(upper_mode);
+    solution.set_result_cache(result_cache);
+    solution.set_binary_codes(binary_codes, binary_mean, binary_rotate);
+    solution.set_fastscan_pq(fastscan_pq);
+    solution.set_projection(projection_dims, projection_random);
+    solution.set_early_abandon(early_abandon);
+    solution.set_dimension_reorder(reorder_dims);
+    solution.set_compressed_adjacency(compress_adjacency);
+    if (partition_size > 0)
+        solution.set_partition_build(partition_size, partition_overlap);
+    shared_ptr<WorkStealingPool> pool;
+    if (pool_threads >= 0)
+    {
+        pool = make_shared<WorkStealingPool>(pool_threads, pin_threads);
+        solution.set_executor(pool);
+        cout << "Executor: work-stealing pool, " << pool->concurrency() << " threads"
+             << (pin_threads ? " (pinned)" : "") << endl;
+    }
+    if (prune_alpha > 0)
+    {
+        solution.set_prune_alpha(prune_alpha);
+    }
+    if (!write_gt_path.empty())
+    {
+        return run_write_groundtruth(dataset_dir, write_gt_path);
+    }
+    if (ivf)
+    {
+        return run_ivf(dataset_dir, ivf_lists, ivf_probe, ivf_sq8, pool);
+    }
+    if (shards > 0)
+    {
+        if (custom_ef_search > 0)
+        {
+            solution.set_ef_search(custom_ef_search);
+        }
+        return run_sharded(dataset_dir, shards, shard_kmeans, shard_probe, solution);
+    }
     bool loaded_from_cache = false;
     int dimension = 0, num_vectors = 0;
 
@@ -294,12 +742,24 @@ int main(int argc, char *argv[])
              << string(60, '=') << endl;
         cout << "[BUILD PHASE] Starting HNSW construction..." << endl;
         cout << "  Vectors: " << num_vectors << " x " << dimension << " dims" << endl;
+        cout << "  Build mode: "
+             << (build_mode == Solution::BUILD_NN_DESCENT ? "NN-Descent"
+                 : build_mode == Solution::BUILD_HNSW_WAVES ? "HNSW waves"
+                 : build_mode == Solution::BUILD_PARTITIONED ? "partitioned" : "HNSW insert")
+             << endl;
         cout << "  Expected time: ~5-15 minutes" << endl;
         cout << string(60, '=') << endl;
         cout << flush;
 
         auto build_start = chrono::high_resolution_clock::now();
         solution.build(dimension, base_vectors);
+        if (rebuild)
+        {
+            // 在同一实例上再构建一次: 检查旧图/压缩邻接表等状态被正确丢弃 (计时只算第二次)
+            cout << "  Rebuilding on the same instance..." << endl;
+            build_start = chrono::high_resolution_clock::now();
+            solution.build(dimension, base_vectors);
+        }
         auto build_end = chrono::high_resolution_clock::now();
         auto build_time = chrono::duration_cast<chrono::milliseconds>(build_end - build_start).count();
 
@@ -316,6 +776,21 @@ int main(int argc, char *argv[])
         {
             cout << "  Status: \u2717 TIMEOUT RISK!" << endl;
         }
+        Solution::HugePageStats hp = solution.huge_page_stats();
+        cout << "  Huge-page coverage: " << (hp.huge_bytes >> 20) << " / " << (hp.total_bytes >> 20) << " MiB";
+        if (hp.total_bytes > 0)
+        {
+            cout << " (" << fixed << setprecision(1) << (100.0 * hp.huge_bytes / hp.total_bytes) << "%)";
+        }
+        cout << endl;
+        cout << "  Layer 0 graph: " << fixed << setprecision(1) << (solution.layer0_graph_bytes() / 1048576.0)
+             << " MiB" << (compress_adjacency ? " (compressed)" : "") << endl;
+        if (projection_dims > 0)
+        {
+            cout << "  Projection: " << dimension << " -> " << solution.projected_dimension() << " dims ("
+                 << (projection_random ? "random" : "PCA") << "), variance retained "
+                 << fixed << setprecision(1) << (100.0 * solution.projection_variance_retained()) << "%" << endl;
+        }
         cout << string(60, '=') << endl;
 
         // Save cache if requested
@@ -334,11 +809,30 @@ int main(int argc, char *argv[])
     }
 
     // Apply custom ef_search if specified
-    // if (custom_ef_search > 0)
-    // {
-    //     cout << "Setting ef_search to " << custom_ef_search << endl;
-    //     solution.set_ef_search(custom_ef_search);
-    // }
+    if (custom_ef_search > 0)
+    {
+        cout << "Setting ef_search to " << custom_ef_search << endl;
+        solution.set_ef_search(custom_ef_search);
+    }
+    if (!disk_index_path.empty())
+    {
+        if (solution.save_disk_index(disk_index_path) &&
+            solution.open_disk_index(disk_index_path, disk_cache_nodes))
+        {
+            cout << "Disk index: " << disk_index_path << " (hot cache " << disk_cache_nodes << " nodes, "
+                 << (solution.disk_index_stats().direct_io ? "O_DIRECT" : "buffered") << ")" << endl;
+        }
+        else
+        {
+            cerr << "Failed to create disk index: " << disk_index_path << endl;
+            return 1;
+        }
+    }
+    if (adaptive_patience > 0)
+    {
+        cout << "Adaptive termination: patience " << adaptive_patience << endl;
+        solution.set_adaptive_termination(adaptive_patience);
+    }
 
     // Load and search queries
     cout << "\nLoading query vectors..." << endl;
@@ -365,6 +859,55 @@ int main(int argc, char *argv[])
         cout << "Loaded groundtruth for " << groundtruth.size() << " queries" << endl;
     }
 
+    // Calibrate adaptive termination on the query set (use a held-out sample in production)
+    if (adaptive_target > 0)
+    {
+        int patience = solution.calibrate_adaptive_termination(queries, adaptive_target);
+        cout << "Adaptive termination calibrated for " << fixed << setprecision(3) << adaptive_target << ": patience " << patience << endl;
+    }
+
+    // Prefetch microbenchmark: same queries, different prefetch settings
+    if (bench_prefetch)
+    {
+        struct PrefetchConfig
+        {
+            const char *name;
+            int distance;
+            int lines;
+        };
+        const PrefetchConfig configs[] = {
+            {"off", 0, 0},
+            {"legacy (2 ahead, 1 line)", 2, 1},
+            {"auto (per-dimension)", -1, -1},
+        };
+        const int reps = 3;
+        cout << "\n"
+             << string(60, '=') << endl;
+        cout << "[PREFETCH BENCHMARK] " << num_vectors << " vectors, " << queries.size() << " queries x " << reps << endl;
+        for (const auto &cfg : configs)
+        {
+            solution.set_prefetch(cfg.distance, cfg.lines);
+            int results[10];
+            for (const auto &q : queries) // warm-up
+            {
+                solution.search(q, results);
+            }
+            auto t0 = chrono::high_resolution_clock::now();
+            for (int r = 0; r < reps; ++r)
+            {
+                for (const auto &q : queries)
+                {
+                    solution.search(q, results);
+                }
+            }
+            auto t1 = chrono::high_resolution_clock::now();
+            double us = chrono::duration_cast<chrono::microseconds>(t1 - t0).count() / (double)(reps * queries.size());
+            cout << "  " << left << setw(28) << cfg.name << right << fixed << setprecision(3) << us / 1000.0 << " ms/query" << endl;
+        }
+        solution.set_prefetch(-1, -1);
+        cout << string(60, '=') << endl;
+    }
+
     // Perform searches
     cout << "\n"
          << string(60, '=') << endl;
@@ -374,8 +917,24 @@ int main(int argc, char *argv[])
     auto search_start = chrono::high_resolution_clock::now();
 
     vector<vector<int>> all_results;
+    if (batch_search)
+    {
+        if (numa_replicas)
+        {
+            int replicas = solution.enable_numa_replicas();
+            cout << "  NUMA replicas: " << replicas << endl;
+            search_start = chrono::high_resolution_clock::now();
+        }
+        solution.set_batch_interleave(interleave);
+        vector<int> batch_results(queries.size() * 10);
+        solution.search_batch(queries, batch_results.data());
+        for (size_t i = 0; i < queries.size(); ++i)
+        {
+            all_results.push_back(vector<int>(batch_results.begin() + i * 10, batch_results.begin() + (i + 1) * 10));
+        }
+    }
     int progress_step = max(1, (int)queries.size() / 10);
-    for (size_t i = 0; i < queries.size(); ++i)
+    for (size_t i = 0; i < queries.size() && !batch_search; ++i)
     {
         if (i > 0 && i % progress_step == 0)
         {
@@ -385,7 +944,18 @@ int main(int argc, char *argv[])
                  << ") - Avg: " << fixed << setprecision(2) << (double)elapsed / i << "ms/query" << endl;
         }
         int results[10];
-        solution.search(queries[i], results);
+        if (intra_threads > 1)
+        {
+            solution.search_intra_parallel(queries[i], results, intra_threads);
+        }
+        else if (exact_search)
+        {
+            solution.search_brute_force(queries[i], results);
+        }
+        else
+        {
+            solution.search(queries[i], results);
+        }
 
         vector<int> result_vec(results, results + 10);
         all_results.push_back(result_vec);
@@ -415,6 +985,33 @@ int main(int argc, char *argv[])
         cout << " \u2713 Excellent";
     }
     cout << endl;
+    if (!disk_index_path.empty())
+    {
+        Solution::DiskIndexStats ds = solution.disk_index_stats();
+        cout << "  Disk reads: " << fixed << setprecision(1) << (double)ds.reads / queries.size()
+             << " records/query, hot-cache hits " << (double)ds.cache_hits / queries.size() << "/query";
+        if (ds.io_errors > 0)
+            cout << ", I/O errors " << ds.io_errors << " queries";
+        cout << endl;
+    }
+
+    // 结果缓存: 重放一遍查询，统计命中
+    if (result_cache > 0)
+    {
+        auto replay_start = chrono::high_resolution_clock::now();
+        int results[10];
+        for (size_t i = 0; i < queries.size(); ++i)
+        {
+            solution.search(queries[i], results);
+        }
+        auto replay_end = chrono::high_resolution_clock::now();
+        auto replay_time = chrono::duration_cast<chrono::microseconds>(replay_end - replay_start).count();
+        Solution::ResultCacheStats cs = solution.result_cache_stats();
+        cout << "  Result cache: " << cs.hits << " hits / " << cs.misses << " misses, "
+             << cs.entries << " entries" << endl;
+        cout << "  Replay time: " << fixed << setprecision(3)
+             << (double)replay_time / 1000.0 / queries.size() << " ms/query" << endl;
+    }
     cout << string(60, '=') << endl;
 
     // Calculate recall